@@ -0,0 +1,27 @@
+#include "Bilerp.h"
+#include "GPixel.h"
+
+static inline GPixel lerp_pixel(GPixel a, GPixel b, unsigned t) {
+	return GPixel_PackARGB(lerp256(GPixel_GetA(a), GPixel_GetA(b), t),
+						   lerp256(GPixel_GetR(a), GPixel_GetR(b), t),
+						   lerp256(GPixel_GetG(a), GPixel_GetG(b), t),
+						   lerp256(GPixel_GetB(a), GPixel_GetB(b), t));
+}
+
+static void bilerp_row(GPixel dst[], const GPixel tl[], const GPixel tr[], const GPixel bl[],
+					   const GPixel br[], const uint16_t fx[], const uint16_t fy[], int count) {
+	for (int i = 0; i < count; i++) {
+		GPixel top = lerp_pixel(tl[i], tr[i], fx[i]);
+		GPixel bottom = lerp_pixel(bl[i], br[i], fx[i]);
+		dst[i] = lerp_pixel(top, bottom, fy[i]);
+	}
+}
+
+BilerpRowProc GetScalarBilerpRowProc() {
+	return bilerp_row;
+}
+
+BilerpRowProc GetBilerpRowProc() {
+	static const BilerpRowProc optsProc = GetBilerpRowProc_SSE2();
+	return optsProc ? optsProc : bilerp_row;
+}
@@ -0,0 +1,38 @@
+#ifndef Bilerp_DEFINED
+#define Bilerp_DEFINED
+
+#include "GPixel.h"
+
+/**
+ *  Bilinear filtering of count pixels: dst[i] is the blend of the four taps tl[i], tr[i], bl[i],
+ *  br[i], weighted by fx[i] (towards the right column) and fy[i] (towards the bottom row), both
+ *  in [0, 256]. The taps are premultiplied, and so is the result.
+ *
+ *      top    = (tl * (256 - fx) + tr * fx + 128) >> 8
+ *      bottom = (bl * (256 - fx) + br * fx + 128) >> 8
+ *      dst    = (top * (256 - fy) + bottom * fy + 128) >> 8
+ */
+typedef void (*BilerpRowProc)(GPixel dst[], const GPixel tl[], const GPixel tr[], const GPixel bl[],
+							  const GPixel br[], const uint16_t fx[], const uint16_t fy[], int count);
+
+/**
+ *  Return the bilinear row kernel, using SIMD if this cpu supports it. It produces exactly the
+ *  same pixels as the scalar one.
+ */
+BilerpRowProc GetBilerpRowProc();
+
+/**
+ *  Return the portable, one-pixel-at-a-time bilinear row kernel.
+ */
+BilerpRowProc GetScalarBilerpRowProc();
+
+/**
+ *  The SIMD kernel, or null if this build has none. Defined in BilerpSSE2.cpp.
+ */
+BilerpRowProc GetBilerpRowProc_SSE2();
+
+static inline unsigned lerp256(unsigned a, unsigned b, unsigned t) {
+	return (a * (256 - t) + b * t + 128) >> 8;
+}
+
+#endif
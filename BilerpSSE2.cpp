@@ -0,0 +1,60 @@
+#include "Bilerp.h"
+#include "GPixel.h"
+
+#if defined(__SSE2__)
+
+#include <emmintrin.h>
+
+namespace {
+	//Spread 4 weights so each one covers the four 16bit channels of its pixel, in lo/hi halves
+	inline void spread_weights(const uint16_t w[], __m128i* lo, __m128i* hi) {
+		__m128i v = _mm_loadl_epi64((const __m128i*) w);
+		v = _mm_unpacklo_epi16(v, v);
+		*lo = _mm_unpacklo_epi32(v, v);
+		*hi = _mm_unpackhi_epi32(v, v);
+	}
+
+	//lerp256 on 16bit channels, the weights sum to 256 so the sum never leaves 16 bits
+	inline __m128i lerp16(__m128i a, __m128i b, __m128i t) {
+		__m128i it = _mm_sub_epi16(_mm_set1_epi16(256), t);
+		__m128i x = _mm_add_epi16(_mm_mullo_epi16(a, it), _mm_mullo_epi16(b, t));
+		return _mm_srli_epi16(_mm_add_epi16(x, _mm_set1_epi16(128)), 8);
+	}
+
+	inline __m128i lo16(__m128i v) { return _mm_unpacklo_epi8(v, _mm_setzero_si128()); }
+	inline __m128i hi16(__m128i v) { return _mm_unpackhi_epi8(v, _mm_setzero_si128()); }
+	inline __m128i load(const GPixel* p) { return _mm_loadu_si128((const __m128i*) p); }
+
+	void bilerp_row_sse2(GPixel dst[], const GPixel tl[], const GPixel tr[], const GPixel bl[],
+						 const GPixel br[], const uint16_t fx[], const uint16_t fy[], int count) {
+		int i = 0;
+		for (; i + 4 <= count; i += 4) {
+			__m128i fxlo, fxhi, fylo, fyhi;
+			spread_weights(fx + i, &fxlo, &fxhi);
+			spread_weights(fy + i, &fylo, &fyhi);
+
+			__m128i vtl = load(tl + i), vtr = load(tr + i), vbl = load(bl + i), vbr = load(br + i);
+			__m128i toplo = lerp16(lo16(vtl), lo16(vtr), fxlo);
+			__m128i tophi = lerp16(hi16(vtl), hi16(vtr), fxhi);
+			__m128i botlo = lerp16(lo16(vbl), lo16(vbr), fxlo);
+			__m128i bothi = lerp16(hi16(vbl), hi16(vbr), fxhi);
+			__m128i r = _mm_packus_epi16(lerp16(toplo, botlo, fylo), lerp16(tophi, bothi, fyhi));
+			_mm_storeu_si128((__m128i*) (dst + i), r);
+		}
+		if (i < count) {
+			GetScalarBilerpRowProc()(dst + i, tl + i, tr + i, bl + i, br + i, fx + i, fy + i, count - i);
+		}
+	}
+}
+
+BilerpRowProc GetBilerpRowProc_SSE2() {
+	return bilerp_row_sse2;
+}
+
+#else
+
+BilerpRowProc GetBilerpRowProc_SSE2() {
+	return nullptr;
+}
+
+#endif
@@ -0,0 +1,240 @@
+#include "Blend.h"
+#include "GBlendMode.h"
+#include "GPixel.h"
+
+//Each of these returns the result of blending a single src pixel onto a single dst pixel
+
+static inline GPixel blend_clear(GPixel sPixel, GPixel dPixel) { //!< [0, 0]
+	return GPixel_PackARGB(0, 0, 0, 0);
+}
+
+static inline GPixel blend_src(GPixel sPixel, GPixel dPixel) { //!< [Sa, Sc]
+	return sPixel;
+}
+
+static inline GPixel blend_dst(GPixel sPixel, GPixel dPixel) { //!< [Da, Dc]
+	return dPixel;
+}
+
+static inline GPixel blend_srcover(GPixel sPixel, GPixel dPixel) { //!< [Sa + Da * (1 - Sa), Sc + Dc * (1 - Sa)]
+	int isA = 255 - GPixel_GetA(sPixel);
+	int rA = GPixel_GetA(sPixel) + div255(isA * GPixel_GetA(dPixel));
+	int rR = GPixel_GetR(sPixel) + div255(isA * GPixel_GetR(dPixel));
+	int rG = GPixel_GetG(sPixel) + div255(isA * GPixel_GetG(dPixel));
+	int rB = GPixel_GetB(sPixel) + div255(isA * GPixel_GetB(dPixel));
+	return GPixel_PackARGB(rA, rR, rG, rB);
+}
+
+static inline GPixel blend_dstover(GPixel sPixel, GPixel dPixel) { //!< [Da + Sa * (1 - Da), Dc + Sc * (1 - Da)]
+	int idA = 255 - GPixel_GetA(dPixel);
+	int rA = GPixel_GetA(dPixel) + div255(idA * GPixel_GetA(sPixel));
+	int rR = GPixel_GetR(dPixel) + div255(idA * GPixel_GetR(sPixel));
+	int rG = GPixel_GetG(dPixel) + div255(idA * GPixel_GetG(sPixel));
+	int rB = GPixel_GetB(dPixel) + div255(idA * GPixel_GetB(sPixel));
+	return GPixel_PackARGB(rA, rR, rG, rB);
+}
+
+static inline GPixel blend_srcin(GPixel sPixel, GPixel dPixel) { //!< [Sa * Da, Sc * Da]
+	int dA = GPixel_GetA(dPixel);
+	int rA = div255(GPixel_GetA(sPixel) * dA);
+	int rR = div255(GPixel_GetR(sPixel) * dA);
+	int rG = div255(GPixel_GetG(sPixel) * dA);
+	int rB = div255(GPixel_GetB(sPixel) * dA);
+	return GPixel_PackARGB(rA, rR, rG, rB);
+}
+
+static inline GPixel blend_dstin(GPixel sPixel, GPixel dPixel) { //!< [Da * Sa, Dc * Sa]
+	int sA = GPixel_GetA(sPixel);
+	int rA = div255(GPixel_GetA(dPixel) * sA);
+	int rR = div255(GPixel_GetR(dPixel) * sA);
+	int rG = div255(GPixel_GetG(dPixel) * sA);
+	int rB = div255(GPixel_GetB(dPixel) * sA);
+	return GPixel_PackARGB(rA, rR, rG, rB);
+}
+
+static inline GPixel blend_srcout(GPixel sPixel, GPixel dPixel) { //!< [Sa * (1 - Da), Sc * (1 - Da)]
+	int idA = 255 - GPixel_GetA(dPixel);
+	int rA = div255(GPixel_GetA(sPixel) * idA);
+	int rR = div255(GPixel_GetR(sPixel) * idA);
+	int rG = div255(GPixel_GetG(sPixel) * idA);
+	int rB = div255(GPixel_GetB(sPixel) * idA);
+	return GPixel_PackARGB(rA, rR, rG, rB);
+}
+
+static inline GPixel blend_dstout(GPixel sPixel, GPixel dPixel) { //!< [Da * (1 - Sa), Dc * (1 - Sa)]
+	int isA = 255 - GPixel_GetA(sPixel);
+	int rA = div255(GPixel_GetA(dPixel) * isA);
+	int rR = div255(GPixel_GetR(dPixel) * isA);
+	int rG = div255(GPixel_GetG(dPixel) * isA);
+	int rB = div255(GPixel_GetB(dPixel) * isA);
+	return GPixel_PackARGB(rA, rR, rG, rB);
+}
+
+static inline GPixel blend_srcatop(GPixel sPixel, GPixel dPixel) { //!< [Da, Sc * Da + Dc * (1 - Sa)]
+	int dA = GPixel_GetA(dPixel);
+	int isA = 255 - GPixel_GetA(sPixel);
+	int rR = div255(GPixel_GetR(sPixel) * dA + GPixel_GetR(dPixel) * isA);
+	int rG = div255(GPixel_GetG(sPixel) * dA + GPixel_GetG(dPixel) * isA);
+	int rB = div255(GPixel_GetB(sPixel) * dA + GPixel_GetB(dPixel) * isA);
+	return GPixel_PackARGB(dA, rR, rG, rB);
+}
+
+static inline GPixel blend_dstatop(GPixel sPixel, GPixel dPixel) { //!< [Sa, Dc * Sa + Sc * (1 - Da)]
+	int sA = GPixel_GetA(sPixel);
+	int idA = 255 - GPixel_GetA(dPixel);
+	int rR = div255(GPixel_GetR(dPixel) * sA + GPixel_GetR(sPixel) * idA);
+	int rG = div255(GPixel_GetG(dPixel) * sA + GPixel_GetG(sPixel) * idA);
+	int rB = div255(GPixel_GetB(dPixel) * sA + GPixel_GetB(sPixel) * idA);
+	return GPixel_PackARGB(sA, rR, rG, rB);
+}
+
+static inline GPixel blend_xor(GPixel sPixel, GPixel dPixel) { //!< [Sa + Da - 2 * Sa * Da, Sc * (1 - Da) + Dc * (1 - Sa)]
+	int sA = GPixel_GetA(sPixel);
+	int dA = GPixel_GetA(dPixel);
+	int rA = sA + dA - div255(2 * sA * dA);
+	int rR = div255(GPixel_GetR(sPixel) * (255 - dA) + GPixel_GetR(dPixel) * (255 - sA));
+	int rG = div255(GPixel_GetG(sPixel) * (255 - dA) + GPixel_GetG(dPixel) * (255 - sA));
+	int rB = div255(GPixel_GetB(sPixel) * (255 - dA) + GPixel_GetB(dPixel) * (255 - sA));
+	return GPixel_PackARGB(rA, rR, rG, rB);
+}
+
+//Stamps out one row blitter per blend function, so the mode is resolved at compile time
+template <GPixel (*blend)(GPixel, GPixel)> void blend_row(GPixel dst[], const GPixel src[], int count) {
+	for (int i = 0; i < count; i++) {
+		dst[i] = blend(src[i], dst[i]);
+	}
+}
+
+static void blend_row_clear(GPixel dst[], const GPixel src[], int count) {
+	memset(dst, 0, count * sizeof(GPixel));
+}
+
+static void blend_row_src(GPixel dst[], const GPixel src[], int count) {
+	memcpy(dst, src, count * sizeof(GPixel));
+}
+
+static void blend_row_dst(GPixel dst[], const GPixel src[], int count) {}
+
+//Indexed by GBlendMode, must stay in the same order as the enum
+static const BlendRowProc gBlendRowProcs[] = {
+	blend_row_clear,
+	blend_row_src,
+	blend_row_dst,
+	blend_row<blend_srcover>,
+	blend_row<blend_dstover>,
+	blend_row<blend_srcin>,
+	blend_row<blend_dstin>,
+	blend_row<blend_srcout>,
+	blend_row<blend_dstout>,
+	blend_row<blend_srcatop>,
+	blend_row<blend_dstatop>,
+	blend_row<blend_xor>,
+};
+
+//Same as blend_row, but for a src that is the same for every pixel
+template <GPixel (*blend)(GPixel, GPixel)> void blend_const(GPixel dst[], GPixel src, int count) {
+	for (int i = 0; i < count; i++) {
+		dst[i] = blend(src, dst[i]);
+	}
+}
+
+static void blend_const_clear(GPixel dst[], GPixel src, int count) {
+	memset(dst, 0, count * sizeof(GPixel));
+}
+
+static void blend_const_src(GPixel dst[], GPixel src, int count) {
+	for (int i = 0; i < count; i++) {
+		dst[i] = src;
+	}
+}
+
+static void blend_const_dst(GPixel dst[], GPixel src, int count) {}
+
+//Indexed by GBlendMode, must stay in the same order as the enum
+static const BlendConstProc gBlendConstProcs[] = {
+	blend_const_clear,
+	blend_const_src,
+	blend_const_dst,
+	blend_const<blend_srcover>,
+	blend_const<blend_dstover>,
+	blend_const<blend_srcin>,
+	blend_const<blend_dstin>,
+	blend_const<blend_srcout>,
+	blend_const<blend_dstout>,
+	blend_const<blend_srcatop>,
+	blend_const<blend_dstatop>,
+	blend_const<blend_xor>,
+};
+
+BlendRowProc GetScalarBlendRowProc(GBlendMode mode) {
+	GASSERT((unsigned) mode < (unsigned) GARRAY_COUNT(gBlendRowProcs));
+	return gBlendRowProcs[static_cast<int>(mode)];
+}
+
+BlendConstProc GetScalarBlendConstProc(GBlendMode mode) {
+	GASSERT((unsigned) mode < (unsigned) GARRAY_COUNT(gBlendConstProcs));
+	return gBlendConstProcs[static_cast<int>(mode)];
+}
+
+static bool use_avx2() {
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("avx2") && GetBlendRowProcs_AVX2();
+#else
+	return false;
+#endif
+}
+
+BlendRowProc GetBlendRowProc(GBlendMode mode) {
+	static const BlendRowProc* optsProcs = use_avx2() ? GetBlendRowProcs_AVX2() : GetBlendRowProcs_SSE2();
+	if (optsProcs && optsProcs[static_cast<int>(mode)]) {
+		return optsProcs[static_cast<int>(mode)];
+	}
+	return GetScalarBlendRowProc(mode);
+}
+
+//Rewrite mode into a cheaper one that gives the same pixels for this particular src alpha
+static GBlendMode fold_src_alpha(GBlendMode mode, GPixel src) {
+	int sA = GPixel_GetA(src);
+	if (sA == 0) {
+		switch (mode) {
+			case GBlendMode::kDst:
+			case GBlendMode::kSrcOver:
+			case GBlendMode::kDstOver:
+			case GBlendMode::kDstOut:
+			case GBlendMode::kSrcATop:
+			case GBlendMode::kXor:
+				return GBlendMode::kDst;
+			default:
+				//src is all zeros, so everything else produces zeros
+				return GBlendMode::kClear;
+		}
+	}
+	if (sA == 255) {
+		switch (mode) {
+			case GBlendMode::kSrcOver:
+				return GBlendMode::kSrc;
+			case GBlendMode::kDstIn:
+				return GBlendMode::kDst;
+			case GBlendMode::kDstOut:
+				return GBlendMode::kClear;
+			case GBlendMode::kSrcATop:
+				return GBlendMode::kSrcIn;
+			default:
+				break;
+		}
+	}
+	return mode;
+}
+
+BlendConstProc GetBlendConstProc(GBlendMode mode, GPixel src) {
+	static const BlendConstProc* optsProcs = use_avx2() ? GetBlendConstProcs_AVX2() : GetBlendConstProcs_SSE2();
+	mode = fold_src_alpha(mode, src);
+	if (mode == GBlendMode::kDst) {
+		return nullptr;
+	}
+	if (optsProcs && optsProcs[static_cast<int>(mode)]) {
+		return optsProcs[static_cast<int>(mode)];
+	}
+	return GetScalarBlendConstProc(mode);
+}
@@ -0,0 +1,58 @@
+#ifndef Blend_DEFINED
+#define Blend_DEFINED
+
+#include "GBlendMode.h"
+#include "GPixel.h"
+
+/**
+ *  Blends count src pixels onto count dst pixels (in place), i.e. dst[i] = blend(src[i], dst[i]).
+ *  Both rows are premultiplied. A proc is chosen once per draw, so the blendmode switch never
+ *  shows up in the per-pixel loop.
+ */
+typedef void (*BlendRowProc)(GPixel dst[], const GPixel src[], int count);
+
+/**
+ *  Return the row blitter for the specified blendmode, using the widest SIMD kernels this cpu
+ *  supports. They all produce exactly the same pixels as GetScalarBlendRowProc().
+ */
+BlendRowProc GetBlendRowProc(GBlendMode mode);
+
+/**
+ *  Return the portable, one-pixel-at-a-time row blitter for the specified blendmode.
+ */
+BlendRowProc GetScalarBlendRowProc(GBlendMode mode);
+
+/**
+ *  Blends the same src pixel onto count dst pixels (in place), i.e. dst[i] = blend(src, dst[i]).
+ */
+typedef void (*BlendConstProc)(GPixel dst[], GPixel src, int count);
+
+/**
+ *  Return the blitter for drawing the constant src with the specified blendmode. The src alpha is
+ *  folded into the mode first, so e.g. an opaque kSrcOver becomes a plain fill, and kDstOut with
+ *  an opaque src becomes a zero fill. Returns null if the pair leaves every dst pixel unchanged
+ *  (kDst, or a transparent src with kSrcOver and friends), in which case there is nothing to draw.
+ */
+BlendConstProc GetBlendConstProc(GBlendMode mode, GPixel src);
+
+/**
+ *  Return the portable, one-pixel-at-a-time constant blitter for the specified blendmode (with
+ *  no folding of the src alpha).
+ */
+BlendConstProc GetScalarBlendConstProc(GBlendMode mode);
+
+/**
+ *  Tables of SIMD blitters indexed by GBlendMode (null entries use the scalar proc), or null if
+ *  this build has no kernels for that instruction set. Defined in BlendSSE2/BlendAVX2.cpp.
+ */
+const BlendRowProc* GetBlendRowProcs_SSE2();
+const BlendRowProc* GetBlendRowProcs_AVX2();
+const BlendConstProc* GetBlendConstProcs_SSE2();
+const BlendConstProc* GetBlendConstProcs_AVX2();
+
+static inline unsigned div255(unsigned x) {
+	x += 128;
+	return x + (x >> 8) >> 8;
+}
+
+#endif
@@ -0,0 +1,76 @@
+#include "Blend.h"
+#include "GBlendMode.h"
+#include "GPixel.h"
+
+//Everything below is compiled for AVX2, and is only ever reached after GetBlendRowProc has
+//checked the cpu. Keep the includes above this line, so no shared inline code gets AVX2 bodies.
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+
+#if defined(__clang__)
+	#pragma clang attribute push (__attribute__((target("avx2"))), apply_to = function)
+#else
+	#pragma GCC push_options
+	#pragma GCC target("avx2")
+#endif
+
+#include <immintrin.h>
+
+namespace {
+	typedef __m256i V;
+	const int kN = 8;
+
+	inline V v_load(const GPixel* p) { return _mm256_loadu_si256((const __m256i*) p); }
+	inline void v_store(GPixel* p, V v) { _mm256_storeu_si256((__m256i*) p, v); }
+
+	//unpack and pack both work within each 128bit half, so pixels come back out in order
+	inline V v_lo16(V v) { return _mm256_unpacklo_epi8(v, _mm256_setzero_si256()); }
+	inline V v_hi16(V v) { return _mm256_unpackhi_epi8(v, _mm256_setzero_si256()); }
+	inline V v_pack16(V lo, V hi) { return _mm256_packus_epi16(lo, hi); }
+
+	inline V v_add16(V a, V b) { return _mm256_add_epi16(a, b); }
+	inline V v_sub16(V a, V b) { return _mm256_sub_epi16(a, b); }
+	inline V v_mul16(V a, V b) { return _mm256_mullo_epi16(a, b); }
+	inline V v_srl16(V a, int n) { return _mm256_srli_epi16(a, n); }
+	inline V v_set16(int x) { return _mm256_set1_epi16(x); }
+	inline V v_alpha16(V v) {
+		v = _mm256_shufflelo_epi16(v, _MM_SHUFFLE(3, 3, 3, 3));
+		return _mm256_shufflehi_epi16(v, _MM_SHUFFLE(3, 3, 3, 3));
+	}
+
+	inline V v_and(V a, V b) { return _mm256_and_si256(a, b); }
+	inline V v_or(V a, V b) { return _mm256_or_si256(a, b); }
+	inline V v_srl32(V a, int n) { return _mm256_srli_epi32(a, n); }
+	inline V v_sll32(V a, int n) { return _mm256_slli_epi32(a, n); }
+	inline V v_add32(V a, V b) { return _mm256_add_epi32(a, b); }
+	inline V v_sub32(V a, V b) { return _mm256_sub_epi32(a, b); }
+	inline V v_set32(unsigned x) { return _mm256_set1_epi32(x); }
+	inline V v_madd16(V a, V b) { return _mm256_madd_epi16(a, b); }
+
+	#include "BlendOpts.h"
+}
+
+#if defined(__clang__)
+	#pragma clang attribute pop
+#else
+	#pragma GCC pop_options
+#endif
+
+const BlendRowProc* GetBlendRowProcs_AVX2() {
+	return gOptsBlendRowProcs;
+}
+
+const BlendConstProc* GetBlendConstProcs_AVX2() {
+	return gOptsBlendConstProcs;
+}
+
+#else
+
+const BlendRowProc* GetBlendRowProcs_AVX2() {
+	return nullptr;
+}
+
+const BlendConstProc* GetBlendConstProcs_AVX2() {
+	return nullptr;
+}
+
+#endif
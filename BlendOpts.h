@@ -0,0 +1,160 @@
+/*
+ *  Vectorized row blitters, written once against a small set of vector helpers.
+ *
+ *  This file is included by BlendSSE2.cpp and BlendAVX2.cpp, each of which first defines (in its
+ *  own namespace):
+ *      V                   the vector type, holding kN pixels
+ *      kN                  how many pixels a V holds
+ *      v_load / v_store    unaligned load/store of kN pixels
+ *      v_lo16 / v_hi16     widen the low/high half of the bytes to 16bit lanes
+ *      v_pack16            narrow two 16bit vectors back into bytes (inverse of lo16/hi16)
+ *      v_add16 / v_sub16 / v_mul16 / v_srl16 / v_set16
+ *      v_alpha16           broadcast each pixel's alpha lane to its other three lanes
+ *      v_and / v_or / v_srl32 / v_sll32 / v_add32 / v_sub32 / v_set32
+ *      v_madd16            sum of adjacent 16bit products into 32bit lanes
+ *
+ *  Every kernel reproduces the scalar procs in Blend.cpp bit for bit (for premultiplied input),
+ *  and leaves the count % kN tail to those scalar procs.
+ *
+ *  Include this inside an anonymous namespace, so that nothing compiled for one instruction set
+ *  can be picked by the linker for another.
+ */
+
+// (x + 128 + ((x + 128) >> 8)) >> 8, exact as long as x <= 255 * 255
+static inline V div255_16(V x) {
+	x = v_add16(x, v_set16(128));
+	return v_srl16(v_add16(x, v_srl16(x, 8)), 8);
+}
+
+static inline V inv16(V x) {
+	return v_sub16(v_set16(255), x);
+}
+
+//One kernel per blendmode. s, d are 16bit channels, sa, da are the matching broadcast alphas.
+
+struct SrcOver {
+	static GBlendMode mode() { return GBlendMode::kSrcOver; }
+	static V blend(V s, V d, V sa, V da) { return v_add16(s, div255_16(v_mul16(d, inv16(sa)))); }
+};
+
+struct DstOver {
+	static GBlendMode mode() { return GBlendMode::kDstOver; }
+	static V blend(V s, V d, V sa, V da) { return v_add16(d, div255_16(v_mul16(s, inv16(da)))); }
+};
+
+struct SrcIn {
+	static GBlendMode mode() { return GBlendMode::kSrcIn; }
+	static V blend(V s, V d, V sa, V da) { return div255_16(v_mul16(s, da)); }
+};
+
+struct DstIn {
+	static GBlendMode mode() { return GBlendMode::kDstIn; }
+	static V blend(V s, V d, V sa, V da) { return div255_16(v_mul16(d, sa)); }
+};
+
+struct SrcOut {
+	static GBlendMode mode() { return GBlendMode::kSrcOut; }
+	static V blend(V s, V d, V sa, V da) { return div255_16(v_mul16(s, inv16(da))); }
+};
+
+struct DstOut {
+	static GBlendMode mode() { return GBlendMode::kDstOut; }
+	static V blend(V s, V d, V sa, V da) { return div255_16(v_mul16(d, inv16(sa))); }
+};
+
+//For the ATop modes the alpha lane works out exactly: div255(Sa * Da + Da * (255 - Sa)) == Da
+struct SrcATop {
+	static GBlendMode mode() { return GBlendMode::kSrcATop; }
+	static V blend(V s, V d, V sa, V da) {
+		return div255_16(v_add16(v_mul16(s, da), v_mul16(d, inv16(sa))));
+	}
+};
+
+struct DstATop {
+	static GBlendMode mode() { return GBlendMode::kDstATop; }
+	static V blend(V s, V d, V sa, V da) {
+		return div255_16(v_add16(v_mul16(d, sa), v_mul16(s, inv16(da))));
+	}
+};
+
+//The alpha lane here is wrong, Xor::fixAlpha replaces it after packing
+struct Xor {
+	static GBlendMode mode() { return GBlendMode::kXor; }
+	static V blend(V s, V d, V sa, V da) {
+		return div255_16(v_add16(v_mul16(s, inv16(da)), v_mul16(d, inv16(sa))));
+	}
+
+	//Sa + Da - div255(2 * Sa * Da), in 32bit lanes since 2 * Sa * Da does not fit in 16 bits
+	static V fixAlpha(V r, V s, V d) {
+		V sa = v_srl32(s, 24);
+		V da = v_srl32(d, 24);
+		V x = v_add32(v_sll32(v_madd16(sa, da), 1), v_set32(128));
+		x = v_srl32(v_add32(x, v_srl32(x, 8)), 8);
+		V a = v_sub32(v_add32(sa, da), x);
+		return v_or(v_and(r, v_set32(0x00FFFFFF)), v_sll32(a, 24));
+	}
+};
+
+template <typename Mode> static inline V fix_alpha(V r, V s, V d) { return r; }
+template <> inline V fix_alpha<Xor>(V r, V s, V d) { return Xor::fixAlpha(r, s, d); }
+
+template <typename Mode> static inline V blend_pixels(V s, V d) {
+	V slo = v_lo16(s), shi = v_hi16(s);
+	V dlo = v_lo16(d), dhi = v_hi16(d);
+	V lo = Mode::blend(slo, dlo, v_alpha16(slo), v_alpha16(dlo));
+	V hi = Mode::blend(shi, dhi, v_alpha16(shi), v_alpha16(dhi));
+	return fix_alpha<Mode>(v_pack16(lo, hi), s, d);
+}
+
+template <typename Mode> static void blend_row_opts(GPixel dst[], const GPixel src[], int count) {
+	int i = 0;
+	for (; i + kN <= count; i += kN) {
+		v_store(dst + i, blend_pixels<Mode>(v_load(src + i), v_load(dst + i)));
+	}
+	if (i < count) {
+		GetScalarBlendRowProc(Mode::mode())(dst + i, src + i, count - i);
+	}
+}
+
+//Same as blend_row_opts, but the src (and so its widened channels and alpha) is loop invariant
+template <typename Mode> static void blend_const_opts(GPixel dst[], GPixel src, int count) {
+	const V s = v_set32(src);
+	int i = 0;
+	for (; i + kN <= count; i += kN) {
+		v_store(dst + i, blend_pixels<Mode>(s, v_load(dst + i)));
+	}
+	if (i < count) {
+		GetScalarBlendConstProc(Mode::mode())(dst + i, src, count - i);
+	}
+}
+
+//Indexed by GBlendMode. Clear, Src and Dst are already memset/memcpy/nothing, so they stay scalar.
+static const BlendRowProc gOptsBlendRowProcs[] = {
+	nullptr,
+	nullptr,
+	nullptr,
+	blend_row_opts<SrcOver>,
+	blend_row_opts<DstOver>,
+	blend_row_opts<SrcIn>,
+	blend_row_opts<DstIn>,
+	blend_row_opts<SrcOut>,
+	blend_row_opts<DstOut>,
+	blend_row_opts<SrcATop>,
+	blend_row_opts<DstATop>,
+	blend_row_opts<Xor>,
+};
+
+static const BlendConstProc gOptsBlendConstProcs[] = {
+	nullptr,
+	nullptr,
+	nullptr,
+	blend_const_opts<SrcOver>,
+	blend_const_opts<DstOver>,
+	blend_const_opts<SrcIn>,
+	blend_const_opts<DstIn>,
+	blend_const_opts<SrcOut>,
+	blend_const_opts<DstOut>,
+	blend_const_opts<SrcATop>,
+	blend_const_opts<DstATop>,
+	blend_const_opts<Xor>,
+};
@@ -0,0 +1,60 @@
+#include "Blend.h"
+#include "GBlendMode.h"
+#include "GPixel.h"
+
+#if defined(__SSE2__)
+
+#include <emmintrin.h>
+
+namespace {
+	typedef __m128i V;
+	const int kN = 4;
+
+	inline V v_load(const GPixel* p) { return _mm_loadu_si128((const __m128i*) p); }
+	inline void v_store(GPixel* p, V v) { _mm_storeu_si128((__m128i*) p, v); }
+
+	inline V v_lo16(V v) { return _mm_unpacklo_epi8(v, _mm_setzero_si128()); }
+	inline V v_hi16(V v) { return _mm_unpackhi_epi8(v, _mm_setzero_si128()); }
+	inline V v_pack16(V lo, V hi) { return _mm_packus_epi16(lo, hi); }
+
+	inline V v_add16(V a, V b) { return _mm_add_epi16(a, b); }
+	inline V v_sub16(V a, V b) { return _mm_sub_epi16(a, b); }
+	inline V v_mul16(V a, V b) { return _mm_mullo_epi16(a, b); }
+	inline V v_srl16(V a, int n) { return _mm_srli_epi16(a, n); }
+	inline V v_set16(int x) { return _mm_set1_epi16(x); }
+	inline V v_alpha16(V v) {
+		v = _mm_shufflelo_epi16(v, _MM_SHUFFLE(3, 3, 3, 3));
+		return _mm_shufflehi_epi16(v, _MM_SHUFFLE(3, 3, 3, 3));
+	}
+
+	inline V v_and(V a, V b) { return _mm_and_si128(a, b); }
+	inline V v_or(V a, V b) { return _mm_or_si128(a, b); }
+	inline V v_srl32(V a, int n) { return _mm_srli_epi32(a, n); }
+	inline V v_sll32(V a, int n) { return _mm_slli_epi32(a, n); }
+	inline V v_add32(V a, V b) { return _mm_add_epi32(a, b); }
+	inline V v_sub32(V a, V b) { return _mm_sub_epi32(a, b); }
+	inline V v_set32(unsigned x) { return _mm_set1_epi32(x); }
+	inline V v_madd16(V a, V b) { return _mm_madd_epi16(a, b); }
+
+	#include "BlendOpts.h"
+}
+
+const BlendRowProc* GetBlendRowProcs_SSE2() {
+	return gOptsBlendRowProcs;
+}
+
+const BlendConstProc* GetBlendConstProcs_SSE2() {
+	return gOptsBlendConstProcs;
+}
+
+#else
+
+const BlendRowProc* GetBlendRowProcs_SSE2() {
+	return nullptr;
+}
+
+const BlendConstProc* GetBlendConstProcs_SSE2() {
+	return nullptr;
+}
+
+#endif
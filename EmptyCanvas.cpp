@@ -10,10 +10,15 @@
 #include "GBlendMode.h"
 #include "GFilter.h"
 #include "GPoint.h"
+#include "Blend.h"
+#include "EmptyCanvas.h"
 #include <iostream>
 #include <stack>
 #include <algorithm>
+#include <cstring>
+#include <memory>
 #include <string>
+#include <vector>
 #include <sys/stat.h>
 #include <unistd.h>
 
@@ -26,11 +31,11 @@ public:
 	float currX;
 	int winding;
 
-    bool init(GPoint p0, GPoint p1) {
-    	winding = 1;
+    //The winding is that of the original segment, +1 if it went down and -1 if it went up
+    bool init(GPoint p0, GPoint p1, int winding) {
+    	this->winding = winding;
     	if (p0.fY > p1.fY) {
 	        std::swap(p0, p1);
-	        winding = -1 * winding;
 	    }
         int y0 = GRoundToInt(p0.fY);
         int y1 = GRoundToInt(p1.fY);
@@ -40,8 +45,8 @@ public:
         minY = std::min(y0, y1);
         maxY = std::max(y0, y1);
         dxdy = (p1.fX - p0.fX) / (p1.fY - p0.fY);
-        w = dxdy * (GRoundToInt(p0.fY) - p0.fY + 0.5);
-        currX = p0.fX + w;
+        this->w = dxdy * (GRoundToInt(p0.fY) - p0.fY + 0.5);
+        currX = p0.fX + this->w;
         return true;
     }
 
@@ -64,14 +69,164 @@ struct Layer {
 public:
 	GBitmap fBitmap;
 	GPaint fPaint;
-	const GRect* fBounds;
-	Layer(GBitmap bitmap, const GRect* bounds, const GPaint& paint) {
+	//Where the layer sits in the surface below it (the previous layer, or the device)
+	GIRect fBounds;
+	//Size of the ctm stack once the layer was saved, so restore() can tell it from a plain save()
+	size_t fSaveDepth;
+	Layer(GBitmap bitmap, const GIRect& bounds, const GPaint& paint, size_t saveDepth) {
 		fBitmap = bitmap;
 		fPaint = paint;
 		fBounds = bounds;
+		fSaveDepth = saveDepth;
 	}
 };
 
+//Pixel memory for the layers at one saveLayer depth, grown as needed and reused by later layers
+struct LayerPixels {
+public:
+	std::unique_ptr<GPixel[]> fPixels;
+	size_t fCount = 0;
+
+	GPixel* reserve(size_t count) {
+		if (count > fCount) {
+			fPixels.reset(new GPixel[count]);
+			fCount = count;
+		}
+		return fPixels.get();
+	}
+};
+
+//The pixels a path clip lets through, as runs of each row, in the coordinates of the surface it was made on
+struct ClipMask {
+public:
+	int fTop;
+	//Row fTop + i is the [x0, x1) pairs in fSpans[fRows[i]] .. fSpans[fRows[i + 1]], sorted and apart
+	std::vector<int> fRows;
+	std::vector<int> fSpans;
+
+	//The spans of row y, as [*begin, *end). Rows outside the mask have none.
+	void row(int y, const int** begin, const int** end) const {
+		int i = y - fTop;
+		if (i < 0 || i + 1 >= (int) fRows.size()) {
+			*begin = *end = nullptr;
+			return;
+		}
+		*begin = fSpans.data() + fRows[i];
+		*end = fSpans.data() + fRows[i + 1];
+	}
+};
+
+//What draws may touch: a rect of the current surface and, after a path clip, just the mask's spans within it
+struct Clip {
+public:
+	GIRect fRect;
+	std::shared_ptr<const ClipMask> fMask;
+	//Surface pixel (x, y) is mask pixel (x + fMaskX, y + fMaskY)
+	int fMaskX;
+	int fMaskY;
+};
+
+//Mix from and to per channel, t / 255 of the way to to
+static inline GPixel lerp_pixel(GPixel from, GPixel to, unsigned t) {
+	unsigned s = 255 - t;
+	return GPixel_PackARGB(div255(GPixel_GetA(to) * t + GPixel_GetA(from) * s),
+						   div255(GPixel_GetR(to) * t + GPixel_GetR(from) * s),
+						   div255(GPixel_GetG(to) * t + GPixel_GetG(from) * s),
+						   div255(GPixel_GetB(to) * t + GPixel_GetB(from) * s));
+}
+
+struct Blitter {
+public:
+	GBitmap* device;
+	GShader* shader;
+	GFilter* filter;
+	BlendRowProc blendRow;
+	BlendConstProc blendConst;
+	GPixel color;
+	GPixel* storage;
+	//Where a row's old pixels are kept while blending with partial coverage
+	GPixel* scratch;
+	//Only rows top <= y < bottom and columns left <= x < right of the device are written (the band and the clip)
+	int top;
+	int bottom;
+	int left;
+	int right;
+	//Within that, only the mask's spans, if there is one
+	const ClipMask* mask;
+	int maskX;
+	int maskY;
+
+	//Blend count pixels of the paint into row y of the device, starting at x. With coverage, pixel
+	//x + i only moves coverage[i] / 255 of the way from its old value to the blended one.
+	void blitRow(int x, int y, int count, const uint8_t* coverage = nullptr) {
+		if (count <= 0 || y < top || y >= bottom) {
+			return;
+		}
+		int l = std::max(x, left);
+		int r = std::min(x + count, right);
+		if (l >= r) {
+			return;
+		}
+		if (!mask) {
+			this->blitPiece(x, l, y, r, coverage);
+			return;
+		}
+		const int* span;
+		const int* end;
+		mask->row(y + maskY, &span, &end);
+		for (; span < end && span[0] - maskX < r; span += 2) {
+			this->blitPiece(x, std::max(l, span[0] - maskX), y, std::min(r, span[1] - maskX), coverage);
+		}
+	}
+
+	//Shade and blend just the visible columns [l, r) of row y, of the span that starts at x
+	void blitPiece(int x, int l, int y, int r, const uint8_t* coverage) {
+		int count = r - l;
+		if (count <= 0) {
+			return;
+		}
+		GPixel* dst = device->getAddr(l, y);
+		//Blend as usual, then pull each pixel back toward what it was by its coverage. That is
+		//right for every blendmode, where scaling the src alpha is only right for the SrcOver family.
+		if (coverage) {
+			memcpy(scratch, dst, count * sizeof(GPixel));
+		}
+		if (shader) {
+			shader->shadeRow(l, y, count, storage);
+			if (filter) {
+				filter->filter(storage, storage, count);
+			}
+			blendRow(dst, storage, count);
+		} else {
+			blendConst(dst, color, count);
+		}
+		if (coverage) {
+			coverage += l - x;
+			for (int i = 0; i < count; i++) {
+				dst[i] = lerp_pixel(scratch[i], dst[i], coverage[i]);
+			}
+		}
+	}
+};
+
+//Curves are flattened until every segment is within this many device pixels of the curve
+static const float kFlattenTolerance = 0.25f;
+
+//Keeps a degenerate (huge or non-finite) curve from asking for an absurd number of segments
+static const int kMaxCurveSegments = 1 << 12;
+
+//Anti-aliased edges are scan converted at 1 << kAAShift sub-rows per pixel row
+static const int kAAShift = 4;
+//What one sub-row's span adds to a pixel it fully covers; a pixel covered on every sub-row reaches 256
+static const int kAARowCoverage = 256 >> kAAShift;
+
+static int clamp_segment_count(float n) {
+	if (!(n < kMaxCurveSegments)) {
+		return kMaxCurveSegments;
+	}
+	return std::max(1, GCeilToInt(n));
+}
+
 struct QuadCurve {
 public:
 	GPoint p0;
@@ -84,12 +239,29 @@ public:
 		p1.set(c.fX, c.fY);
 	}
 
-	float getX(float t) {
-		return p0.fX * pow(1.0f - t, 2) + controlPoint.fX * 2.0f * (1.0f - t) * t + p1.fX * pow(t, 2);
+	//Fewest segments that stay within tol of the curve (Wang's formula: sqrt(|p0 - 2c + p1| / (4 * tol)))
+	int segmentCount(float tol) const {
+		GVector d = (p0 - controlPoint) - (controlPoint - p1);
+		return clamp_segment_count(sqrtf(d.length() / (4.0f * tol)));
 	}
 
-	float getY(float t) {
-		return p0.fY * pow(1.0f - t, 2) + controlPoint.fY * 2.0f * (1.0f - t) * t + p1.fY * pow(t, 2);
+	//Writes the segmentCount + 1 evenly spaced points of the curve into pts, by forward differencing
+	void flatten(int segmentCount, GPoint pts[]) const {
+		//P(t) = A*t^2 + B*t + p0
+		GVector A = (p0 - controlPoint) - (controlPoint - p1);
+		GVector B = 2.0f * (controlPoint - p0);
+		float h = 1.0f / segmentCount;
+		GVector d1 = A * (h * h) + B * h;
+		GVector d2 = A * (2.0f * h * h);
+
+		GPoint p = p0;
+		pts[0] = p0;
+		for (int i = 1; i < segmentCount; i++) {
+			p += d1;
+			d1 = d1 + d2;
+			pts[i] = p;
+		}
+		pts[segmentCount] = p1;
 	}
 };
 
@@ -107,80 +279,98 @@ public:
 		p1.set(d.fX, d.fY);
 	}
 
-	float getX(float t) {
-		return p0.fX * pow(1.0f - t, 3) + controlPoint0.fX * 3.0f * pow(1.0f - t, 2) * t + controlPoint1.fX * 3.0f * (1 - t) * pow(t, 2) + p1.fX * pow(t, 3);
+	//Fewest segments that stay within tol of the curve (Wang's formula: sqrt(3 * max|second difference| / (4 * tol)))
+	int segmentCount(float tol) const {
+		GVector d0 = (p0 - controlPoint0) - (controlPoint0 - controlPoint1);
+		GVector d1 = (controlPoint0 - controlPoint1) - (controlPoint1 - p1);
+		float d = std::max(d0.length(), d1.length());
+		return clamp_segment_count(sqrtf(3.0f * d / (4.0f * tol)));
 	}
 
-	float getY(float t) {
-		return p0.fY * pow(1.0f - t, 3) + controlPoint0.fY * 3.0f * pow(1.0f - t, 2) * t + controlPoint1.fY * 3.0f * (1 - t) * pow(t, 2) + p1.fY * pow(t, 3);
+	//Writes the segmentCount + 1 evenly spaced points of the curve into pts, by forward differencing
+	void flatten(int segmentCount, GPoint pts[]) const {
+		//P(t) = A*t^3 + B*t^2 + C*t + p0
+		GVector A = (p1 - p0) + 3.0f * (controlPoint0 - controlPoint1);
+		GVector B = 3.0f * ((p0 - controlPoint0) - (controlPoint0 - controlPoint1));
+		GVector C = 3.0f * (controlPoint0 - p0);
+		float h = 1.0f / segmentCount;
+		float h2 = h * h;
+		float h3 = h2 * h;
+		GVector d1 = A * h3 + B * h2 + C * h;
+		GVector d2 = A * (6.0f * h3) + B * (2.0f * h2);
+		GVector d3 = A * (6.0f * h3);
+
+		GPoint p = p0;
+		pts[0] = p0;
+		for (int i = 1; i < segmentCount; i++) {
+			p += d1;
+			d1 = d1 + d2;
+			d2 = d2 + d3;
+			pts[i] = p;
+		}
+		pts[segmentCount] = p1;
 	}
 };
 
 class EmptyCanvas: public GCanvas {
 public: 
 
-	EmptyCanvas(const GBitmap& device) : fDevice(device) {
+	EmptyCanvas(const GBitmap& device, int bandTop, int bandBottom) : fDevice(device), fBandTop(bandTop), fBandBottom(bandBottom), fSurfaceTop(0) {
 		this->ctm = GMatrix();
 		this->currentDevice = &this->fDevice;
+		this->fClip.fRect = GIRect::MakeWH(device.width(), device.height());
+		this->fClip.fMaskX = 0;
+		this->fClip.fMaskY = 0;
 	}
 
 	void drawPaint(const GPaint& paint) override {
-		//Get paint shader and set CTM
-		GShader* shader = paint.getShader();
-		if (shader) {
-			if (!shader->setContext(this->ctm)) {
-				return;
-			}
+		Blitter blitter;
+		if (!this->setupBlitter(paint, &blitter)) {
+			return;
 		}
-		
-		//Get paint blend mode
-		GBlendMode mode = paint.getBlendMode();
-
-		//Get paint color
-		GColor color = paint.getColor().pinToUnit();
-	    int iA = GRoundToInt(GPinToUnit(color.fA) * 255);
-	    int iR = GRoundToInt(color.fR * color.fA * 255);
-	    int iG = GRoundToInt(color.fG * color.fA * 255);
-	    int iB = GRoundToInt(color.fB * color.fA * 255);
-
-	    GPixel dPixel;
-	    GPixel rPixel;
-	    GPixel sPixel = GPixel_PackARGB(iA, iR, iG, iB);
-
-	    //Get paint filter
-	    GFilter* fl = paint.getFilter();
-	    if (fl) {
-	    	fl->filter(&sPixel, &sPixel, 1);
-	    }
-	    
-	    GPixel pixelStorage[this->currentDevice->width()];
 
 	    //Fill in the bitmap
-	    for (int y = 0; y < this->currentDevice->height(); y++) {
-	    	if (shader) {
-	    		//If shader is present, retrieve the shader pixels
-	    		shader->shadeRow(0, y, this->currentDevice->width(), pixelStorage);
-	    		//If the filter is present, filter each shader pixel
-		    	if (fl) {
-		    		fl->filter(pixelStorage, pixelStorage, this->currentDevice->width());
-		    	}
-	    	}
-	    	int pixelStorageIndex = 0;
-	    	//Walk through each of the x, y coordinates
-	    	for (int x = 0; x < this->currentDevice->width(); x++) {
-	    		GPixel* address = this->currentDevice->getAddr(x, y);
-	    		memcpy(&dPixel, address, sizeof(GPixel));
-	    		if (shader) {
-	    			sPixel = pixelStorage[pixelStorageIndex];
-	    			pixelStorageIndex++;
-	    		}
-	    		rPixel = generateRPixel(mode, sPixel, dPixel);
-	    		memcpy(address, &rPixel, sizeof(GPixel));
-	    	}
+	    for (int y = blitter.top; y < blitter.bottom; y++) {
+	    	blitter.blitRow(0, y, this->currentDevice->width());
 	    }
 	}
 
 	void drawRect(const GRect& rect, const GPaint& paint) override {
+		//Without rotation or skew the rect stays axis-aligned, so fill its rows directly
+		if (this->ctm[GMatrix::KX] == 0 && this->ctm[GMatrix::KY] == 0) {
+			GPoint corners[2];
+			corners[0] = GPoint::Make(rect.fLeft, rect.fTop);
+			corners[1] = GPoint::Make(rect.fRight, rect.fBottom);
+			this->ctm.mapPoints(corners, corners, 2);
+			GRect mapped = GRect::MakeLTRB(std::min(corners[0].fX, corners[1].fX), std::min(corners[0].fY, corners[1].fY),
+										   std::max(corners[0].fX, corners[1].fX), std::max(corners[0].fY, corners[1].fY));
+			GIRect deviceRect = mapped.round();
+			//Edges between pixels cover whole pixels, so only a rect with fractional edges needs anti-aliasing
+			if (paint.isAntiAlias() && mapped != GRect::Make(deviceRect)) {
+				this->drawRectAsPolygon(rect, paint);
+				return;
+			}
+			//Only the rows are cut here; blitRow clips the columns to the clip
+			int top, bottom;
+			this->surfaceRows(&top, &bottom);
+			if (this->quickReject(GRect::Make(deviceRect)) ||
+				!deviceRect.intersect(GIRect::MakeLTRB(0, top, this->currentDevice->width(), bottom))) {
+				return;
+			}
+
+			Blitter blitter;
+			if (!this->setupBlitter(paint, &blitter)) {
+				return;
+			}
+			for (int y = deviceRect.top(); y < deviceRect.bottom(); y++) {
+				blitter.blitRow(deviceRect.left(), y, deviceRect.width());
+			}
+			return;
+		}
+		this->drawRectAsPolygon(rect, paint);
+ 	}
+
+ 	void drawRectAsPolygon(const GRect& rect, const GPaint& paint) {
 		//Convert rectange bounds into polygon and use the draw convex polygon formula
 		GPoint points[4];
 		points[0] = GPoint::Make(rect.fLeft, rect.fTop);
@@ -195,77 +385,52 @@ public:
  		//Array of transformed polygon points
  		GPoint transformedPoints[count];
  		this->ctm.mapPoints(transformedPoints, points, count);
+ 		if (this->quickReject(bounds_of(transformedPoints, count))) {
+ 			return;
+ 		}
 
- 		//Get paint shader and set CTM
-		GShader* shader = paint.getShader();
-		if (shader) {
-			if (!shader->setContext(this->ctm)) {
-				return;
-			}
+		Blitter blitter;
+		if (!this->setupBlitter(paint, &blitter)) {
+			return;
 		}
-		
-		//Get paint blend mode
-		GBlendMode mode = paint.getBlendMode();
-
-		//Get paint color
-		GColor color = paint.getColor().pinToUnit();
-	    int iA = GRoundToInt(GPinToUnit(color.fA) * 255);
-	    int iR = GRoundToInt(color.fR * color.fA * 255);
-	    int iG = GRoundToInt(color.fG * color.fA * 255);
-	    int iB = GRoundToInt(color.fB * color.fA * 255);
-
-	    GPixel dPixel;
-	    GPixel rPixel;
-	    GPixel sPixel = GPixel_PackARGB(iA, iR, iG, iB);
 
-	    //Get paint filter
-	    GFilter* fl = paint.getFilter();
-	    if (fl) {
-	    	fl->filter(&sPixel, &sPixel, 1);
-	    }
+		if (paint.isAntiAlias()) {
+			GRect bounds = this->edgeBounds(kAAShift);
+			this->fEdges.clear();
+			for (int i = 0; i < count; i++) {
+				add_line(bounds, transformedPoints[i], transformedPoints[(i + 1) % count], kAAShift, this->fEdges);
+			}
+			this->fillAntiAliased(blitter);
+			return;
+		}
 
 	    //This is the rectangle to clip with
- 		GRect bounds = GRect::MakeXYWH(0.0f, 0.0f, this->currentDevice->width(), this->currentDevice->height());
- 		Edge storage[1000];
- 		Edge* edge = storage;
+ 		GRect bounds = this->edgeBounds(0);
+ 		std::vector<Edge>& storage = this->fEdges;
+ 		storage.clear();
 		GPoint p0;
 		GPoint p1;
  		for (int i = 0; i < count; i++) {
  			if (i + 1 == count) {
  				p0 = transformedPoints[i];
 				p1 = transformedPoints[0];
-				edge = clip_line(bounds, p0, p1, edge);
+				clip_line(bounds, p0, p1, storage);
  			} else {
  				p0 = transformedPoints[i];
 				p1 = transformedPoints[i + 1];
- 				edge = clip_line(bounds, p0, p1, edge);
- 			}
- 		}
- 		int edgeCount = edge - storage;
- 		Edge tmp;
-
-		for (int i = 0; i < edgeCount; i++) {
- 			for (int j = i + 1; j < edgeCount; j++) {
- 				if (storage[i].minY > storage[j].minY) {
- 					tmp = storage[i];
- 					storage[i] = storage[j];
- 					storage[j] = tmp;
- 				}
+ 				clip_line(bounds, p0, p1, storage);
  			}
  		}
-
- 		//Stable sort storage by maxY
- 		for (int i = 0; i < edgeCount; i++) {
- 			for (int j = i + 1; j < edgeCount; j++) {
- 				if (storage[i].minY == storage[j].minY && storage[i].maxY > storage[j].maxY) {
- 					tmp = storage[i];
- 					storage[i] = storage[j];
- 					storage[j] = tmp;
- 				}
- 			}
+ 		int edgeCount = storage.size();
+ 		//Nothing left after clipping (or the polygon was flat)
+ 		if (edgeCount < 2) {
+ 			return;
  		}
 
- 		//After sorting, storage should now be sorted first by minY and then by maxY
+		//Sort by top row and then by bottom row, so the edges are used in the order the rows reach them
+		std::sort(storage.begin(), storage.end(), [](const Edge& a, const Edge& b) {
+			return a.minY < b.minY || (a.minY == b.minY && a.maxY < b.maxY);
+		});
 
  		int minY = GRoundToInt(bounds.bottom());
  		int maxY = GRoundToInt(bounds.top());
@@ -275,22 +440,27 @@ public:
  			maxY = std::min(GRoundToInt(bounds.bottom()), std::max(storage[i].maxY, maxY));
  		}
 
- 		GPixel pixelStorage[GRoundToInt(bounds.width())];
-
  		int edgeStorageIndex = 0;
  		Edge e0 = storage[edgeStorageIndex];
  		edgeStorageIndex++;
  		Edge e1 = storage[edgeStorageIndex];
  		edgeStorageIndex++;
 
- 		for (int y = minY; y < maxY; y++) {
+ 		for (int y = minY; y < maxY && y < blitter.bottom; y++) {
 
+ 			//A convex polygon has exactly two edges on each covered row, but a degenerate one can run out early
  			if (!(e0.containsY(y))) {
+ 				if (edgeStorageIndex >= edgeCount) {
+ 					break;
+ 				}
  				e0 = storage[edgeStorageIndex];
  				edgeStorageIndex++;
  			}
 
  			if (!(e1.containsY(y))) {
+ 				if (edgeStorageIndex >= edgeCount) {
+ 					break;
+ 				}
  				e1 = storage[edgeStorageIndex];
  				edgeStorageIndex++;
  			}
@@ -299,93 +469,153 @@ public:
  			int rightX = std::max(GRoundToInt(bounds.left()), std::min(GRoundToInt(bounds.right()), GRoundToInt(std::max(e0.currX, e1.currX))));
  			// std::cout << "leftX: " << leftX << "\n";
  			// std::cout << "rightX: " << rightX << "\n";
-			if (shader) {
-				shader->shadeRow(leftX, y, rightX - leftX, pixelStorage);
-		    	if (fl) {
-		    		fl->filter(pixelStorage, pixelStorage, rightX - leftX);
-		    	}
-			}
- 			int pixelStorageIndex = 0;
- 			for (int x = leftX; x < rightX; x++) {
- 				GPixel* address = this->currentDevice->getAddr(x, y);
-	    		memcpy(&dPixel, address, sizeof(GPixel));
-	    		if (shader) {
-    				sPixel = pixelStorage[pixelStorageIndex];
-	    			pixelStorageIndex++;
-	    		}
-	    		rPixel = generateRPixel(mode, sPixel, dPixel);
-	    		memcpy(address, &rPixel, sizeof(GPixel));
- 			}
+			blitter.blitRow(leftX, y, rightX - leftX);
  			e0.incrementCurrX();
  			e1.incrementCurrX();
  		}
  	}
 
  	void drawPath(const GPath& path, const GPaint& paint) {
- 		//Get paint shader and set CTM
-		GShader* shader = paint.getShader();
-		if (shader) {
-			if (!shader->setContext(this->ctm)) {
-				return;
-			}
+		//Curves stay inside their control points, so this is conservative before flattening
+		if (this->quickReject(this->mapRect(path.bounds()))) {
+			return;
 		}
-		
-		//Get paint blend mode
-		GBlendMode mode = paint.getBlendMode();
 
-		//Get paint color
-		GColor color = paint.getColor().pinToUnit();
-	    int iA = GRoundToInt(GPinToUnit(color.fA) * 255);
-	    int iR = GRoundToInt(color.fR * color.fA * 255);
-	    int iG = GRoundToInt(color.fG * color.fA * 255);
-	    int iB = GRoundToInt(color.fB * color.fA * 255);
+		Blitter blitter;
+		if (!this->setupBlitter(paint, &blitter)) {
+			return;
+		}
+		if (paint.isAntiAlias()) {
+			this->buildEdges(path, kAAShift);
+			this->fillAntiAliased(blitter);
+			return;
+		}
+		this->fillPath(path, blitter.bottom, [&blitter](int x, int y, int count) {
+			blitter.blitRow(x, y, count);
+		});
+ 	}
 
-	    GPixel dPixel;
-	    GPixel rPixel;
-	    GPixel sPixel = GPixel_PackARGB(iA, iR, iG, iB);
+ 	//Scan convert the path (mapped by the CTM) with winding-fill, calling span(x, y, count) for each run
+ 	//of the current surface it covers, row by row from the top and left to right, stopping at row bottom
+ 	template <typename SpanProc> void fillPath(const GPath& path, int bottom, SpanProc span) {
+ 		this->buildEdges(path, 0);
+		int width = this->currentDevice->width();
+ 		this->walkEdges(bottom, [&](float left, float right, int y) {
+			int l = std::max(0, std::min(GRoundToInt(left), width));
+			int r = std::max(0, std::min(GRoundToInt(right), width));
+			span(l, y, r - l);
+ 		});
+ 	}
 
-	    //Get paint filter
-	    GFilter* fl = paint.getFilter();
-	    if (fl) {
-	    	fl->filter(&sPixel, &sPixel, 1);
-	    }
+ 	//Fill the edges in fEdges, built with kAAShift, giving each pixel the share of its sub-rows' spans
+ 	//that overlap it. Fully covered runs blit as usual, and only the pixels along the edges blend
+ 	//by their coverage.
+ 	void fillAntiAliased(Blitter& blitter) {
+ 		int width = this->currentDevice->width();
+ 		//Per pixel of the current row, what the spans add to just it, and (summed left to right
+ 		//once the row is done) to it and every pixel after it. Both are left zeroed between rows.
+ 		std::vector<int>& partial = this->fCoverage;
+ 		std::vector<int>& delta = this->fCoverageDelta;
+ 		if (partial.size() < (size_t) width + 1) {
+ 			partial.assign(width + 1, 0);
+ 			delta.assign(width + 1, 0);
+ 			this->fCoverageRow.resize(width + 1);
+ 		}
+ 		uint8_t* coverage = this->fCoverageRow.data();
+ 		int row = 0;
+ 		int rowLeft = width + 1;
+ 		int rowRight = 0;
+
+ 		auto flush = [&]() {
+ 			int sum = 0;
+ 			for (int x = rowLeft; x < rowRight; x++) {
+ 				sum += delta[x];
+ 				coverage[x] = std::min(255, partial[x] + sum);
+ 				partial[x] = 0;
+ 				delta[x] = 0;
+ 			}
+ 			int end = std::min(rowRight, width);
+ 			for (int x = rowLeft; x < end;) {
+ 				int start = x;
+ 				if (coverage[x] == 0) {
+ 					for (; x < end && coverage[x] == 0; x++) {}
+ 				} else if (coverage[x] == 255) {
+ 					for (; x < end && coverage[x] == 255; x++) {}
+ 					blitter.blitRow(start, row, x - start);
+ 				} else {
+ 					for (; x < end && coverage[x] != 0 && coverage[x] != 255; x++) {}
+ 					blitter.blitRow(start, row, x - start, coverage + start);
+ 				}
+ 			}
+ 			rowLeft = width + 1;
+ 			rowRight = 0;
+ 		};
+
+ 		this->walkEdges(blitter.bottom << kAAShift, [&](float left, float right, int subY) {
+ 			int y = subY >> kAAShift;
+ 			if (y != row) {
+ 				flush();
+ 				row = y;
+ 			}
+ 			if (y < blitter.top) {
+ 				return;
+ 			}
+ 			left = std::max(0.0f, std::min(left, (float) width));
+ 			right = std::max(0.0f, std::min(right, (float) width));
+ 			if (!(left < right)) {
+ 				return;
+ 			}
+ 			int l = (int) left;
+ 			int r = (int) right;
+ 			if (l == r) {
+ 				partial[l] += GRoundToInt((right - left) * kAARowCoverage);
+ 			} else {
+ 				partial[l] += GRoundToInt((l + 1 - left) * kAARowCoverage);
+ 				delta[l + 1] += kAARowCoverage;
+ 				delta[r] -= kAARowCoverage;
+ 				partial[r] += GRoundToInt((right - r) * kAARowCoverage);
+ 			}
+ 			rowLeft = std::min(rowLeft, l);
+ 			rowRight = std::max(rowRight, r + 1);
+ 		});
+ 		flush();
+ 	}
 
-	    GRect bounds = GRect::MakeXYWH(0.0f, 0.0f, this->currentDevice->width(), this->currentDevice->height());
- 		Edge storage[1000];
- 		Edge* edge = storage;
-		GPoint p0;
-		GPoint p1;
+ 	//The current surface as a rect to clip edges to, with its rows scaled up by 1 << shift
+ 	GRect edgeBounds(int shift) const {
+ 		return GRect::MakeWH(this->currentDevice->width(), this->currentDevice->height() << shift);
+ 	}
+
+ 	//Flatten the path (mapped by the CTM) into fEdges, clipped to the current surface. With a shift
+ 	//the rows are scaled up by 1 << shift, so the edges step once per sub-row.
+ 	void buildEdges(const GPath& path, int shift) {
+	    GRect bounds = this->edgeBounds(shift);
+ 		std::vector<Edge>& storage = this->fEdges;
+ 		storage.clear();
 		GPath::Edger edger(path);
 		GPoint pContainer[4];
-		Edge tmp;
 
 		GPath::Verb currentVerb;
 		while ((currentVerb = edger.next(pContainer)) != GPath::Verb::kDone) {
 			int segmentCount;
-			float step;
 			switch (currentVerb) {
 				case GPath::Verb::kLine:
 					{
 						this->ctm.mapPoints(pContainer, pContainer, 2);
-						edge = clip_line(bounds, pContainer[0], pContainer[1], edge);
+						add_line(bounds, pContainer[0], pContainer[1], shift, storage);
 						break;
 					}
 					
 				case GPath::Verb::kQuad:
 					{
+						//Flatten in device space, so the segment count follows the on-screen size
 						this->ctm.mapPoints(pContainer, pContainer, 3);
 						QuadCurve qCurve(pContainer[0], pContainer[1], pContainer[2]);
-						//11 points
-						segmentCount = 20;
-						step = 1.0f / (float) segmentCount;
-						GPoint qCoordinates[segmentCount + 1];
-						qCoordinates[0] = GPoint::Make(qCurve.getX(0.0f), qCurve.getY(0.0f));
-						for (int i = 1; i <= segmentCount; i++) {
-							float t = i * step;
-							qCoordinates[i] = GPoint::Make(qCurve.getX(t), qCurve.getY(t));
-						}
+						segmentCount = qCurve.segmentCount(kFlattenTolerance);
+						this->fCurvePoints.resize(segmentCount + 1);
+						qCurve.flatten(segmentCount, this->fCurvePoints.data());
 						for (int i = 0; i < segmentCount; i++) {
-							edge = clip_line(bounds, qCoordinates[i], qCoordinates[i + 1], edge);
+							add_line(bounds, this->fCurvePoints[i], this->fCurvePoints[i + 1], shift, storage);
 						}
 						break;
 					}
@@ -394,152 +624,125 @@ public:
 					{
 						this->ctm.mapPoints(pContainer, pContainer, 4);
 						CubicCurve cCurve(pContainer[0], pContainer[1], pContainer[2], pContainer[3]);
-						//11 points
-						segmentCount = 10;
-						step = 1.0f / (float) segmentCount;
-						GPoint cCoordinates[segmentCount + 1];
-						cCoordinates[0] = GPoint::Make(cCurve.getX(0.0f), cCurve.getY(0.0f));
-						for (int i = 1; i <= segmentCount; i++) {
-							float t = i * step;
-							cCoordinates[i] = GPoint::Make(cCurve.getX(t), cCurve.getY(t));
-						}
+						segmentCount = cCurve.segmentCount(kFlattenTolerance);
+						this->fCurvePoints.resize(segmentCount + 1);
+						cCurve.flatten(segmentCount, this->fCurvePoints.data());
 						for (int i = 0; i < segmentCount; i++) {
-							edge = clip_line(bounds, cCoordinates[i], cCoordinates[i + 1], edge);
+							add_line(bounds, this->fCurvePoints[i], this->fCurvePoints[i + 1], shift, storage);
 						}
 						break;
 					}
 			}
 			
 		}
+ 	}
 
-		int edgeCount = edge - storage;
-
-		for (int i = 0; i < edgeCount; i++) {
- 			for (int j = i + 1; j < edgeCount; j++) {
- 				if (storage[i].minY > storage[j].minY) {
- 					tmp = storage[i];
- 					storage[i] = storage[j];
- 					storage[j] = tmp;
- 				}
- 			}
- 		}
+ 	//Walk the edges in fEdges with winding-fill, calling run(left, right, y) with the x of the edges
+ 	//around each covered run, row by row from the top and left to right, stopping at row bottom
+ 	template <typename RunProc> void walkEdges(int bottom, RunProc run) {
+ 		std::vector<Edge>& storage = this->fEdges;
+		int edgeCount = storage.size();
+
+		//Sort once by top row, and by x within a row, so edges enter the active list in order
+		std::sort(storage.begin(), storage.end(), [](const Edge& a, const Edge& b) {
+			return a.minY < b.minY || (a.minY == b.minY && a.currX < b.currX);
+		});
+
+		//Edges crossing the current row, kept sorted by currX
+		std::vector<Edge*>& active = this->fActiveEdges;
+		active.clear();
+		int nextEdge = 0;
+		int y = 0;
+		while (nextEdge < edgeCount || !active.empty()) {
+			//Skip straight to the next edge if nothing is active
+			if (active.empty()) {
+				y = storage[nextEdge].minY;
+			}
+			//Rows above the band still step the edges, so the band's rows match a full draw
+			if (y >= bottom) {
+				break;
+			}
 
- 		//Stable sort storage by maxY
- 		for (int i = 0; i < edgeCount; i++) {
- 			for (int j = i + 1; j < edgeCount; j++) {
- 				if (storage[i].minY == storage[j].minY && storage[i].currX > storage[j].currX) {
- 					tmp = storage[i];
- 					storage[i] = storage[j];
- 					storage[j] = tmp;
- 				}
- 			}
- 		}
+			//Insert the edges that start on this row
+			for (; nextEdge < edgeCount && storage[nextEdge].minY == y; nextEdge++) {
+				Edge* e = &storage[nextEdge];
+				int i = active.size();
+				active.push_back(e);
+				for (; i > 0 && active[i - 1]->currX > e->currX; i--) {
+					active[i] = active[i - 1];
+				}
+				active[i] = e;
+			}
 
- 		int minY = bounds.bottom();
- 		int maxY = bounds.top();
+			//Walk left to right, filling wherever the winding is non-zero
+			int winding = 0;
+			float left = 0;
+			for (Edge* e : active) {
+				if (winding == 0) {
+					left = e->currX;
+				}
+				winding += e->winding;
+				if (winding == 0) {
+					run(left, e->currX, y);
+				}
+			}
 
- 		for (int i = 0; i < edgeCount; i++) {
- 			minY = std::max(GRoundToInt(bounds.top()), std::min(storage[i].minY, minY));
- 			maxY = std::min(GRoundToInt(bounds.bottom()), std::max(storage[i].maxY, maxY));
- 		}
- 		
- 		for (int y = minY; y < maxY; y++) {
- 			std::vector<int> xValues;
- 			for (int i = 0; i < edgeCount; i++) {
- 				if (storage[i].containsY(y)) {
- 					xValues.push_back(storage[i].currX);
- 					storage[i].incrementCurrX();
- 				}
- 			}
- 			std::sort(xValues.begin(), xValues.end());
- 			// xValues.erase( std::unique( xValues.begin(), xValues.end() ), xValues.end() );
-
- 			for (int j = 0; j < xValues.size(); j++) {
- 				if (j % 2 == 0) {
- 					GPixel pixelStorage[GRoundToInt(bounds.width())];
- 					int minX = std::max(0, std::min(xValues[j], GRoundToInt(bounds.width())));
-					int maxX = std::max(0, std::min(xValues[j + 1], GRoundToInt(bounds.width())));
-					if (shader) {
-						shader->shadeRow(minX, y, maxX - minX, pixelStorage);
-				    	if (fl) {
-				    		fl->filter(pixelStorage, pixelStorage, maxX - minX);
-				    	}
-					}
-					int pixelStorageIndex = 0;
-					for (int x = minX; x < maxX; x++) {
-		 				GPixel* address = this->currentDevice->getAddr(x, y);
-			    		memcpy(&dPixel, address, sizeof(GPixel));
-			    		if (shader) {
-		    				sPixel = pixelStorage[pixelStorageIndex];
-							pixelStorageIndex++;
-			    		}
-			    		rPixel = generateRPixel(mode, sPixel, dPixel);
-			    		memcpy(address, &rPixel, sizeof(GPixel));
-		 			}
- 				}
- 			}
- 			// std::vector<Edge*> activeEdges;
- 			// Edge* e1;
- 			// for (int i = 0; i < edgeCount; i++) {
- 			// 	if (storage[i].containsY(y)) {
- 			// 		e1 = storage[i];
- 			// 		activeEdges.push_back(e1);
- 			// 	}
- 			// }
-
- 			// int winding = 0;
- 			// //Sort activEdges based on currX
- 			// int leftX;
- 			// int rightX;
- 			// GPixel pixelStorage[GRoundToInt(bounds.width())];
- 			// for (int i = 0; i < edgeCount; i++) {
- 			// 	if (storage[i].containsY(y)) {
- 			// 		if (winding == 0) {
- 			// 			leftX = std::max(0, std::min(GRoundToInt(storage[i].currX), GRoundToInt(bounds.width())));
- 			// 			storage[i].incrementCurrX();
- 			// 		}
- 			// 		winding += storage[i].winding;
- 			// 		if (winding == 0) {
- 			// 			rightX = std::max(0, std::min(GRoundToInt(storage[i].currX), GRoundToInt(bounds.width())));
- 			// 			storage[i].incrementCurrX();
- 			// 			if (shader) {
-				// 			shader->shadeRow(leftX, y, rightX - leftX, pixelStorage);
-				// 	    	if (fl) {
-				// 	    		fl->filter(pixelStorage, pixelStorage, rightX - leftX);
-				// 	    	}
-				// 		}
-				// 		int pixelStorageIndex = 0;
-				// 		for (int x = leftX; x < rightX; x++) {
-			 // 				GPixel* address = this->currentDevice->getAddr(x, y);
-				//     		memcpy(&dPixel, address, sizeof(GPixel));
-				//     		if (shader) {
-			 //    				sPixel = pixelStorage[pixelStorageIndex];
-				// 				pixelStorageIndex++;
-				//     		}
-				//     		rPixel = generateRPixel(mode, sPixel, dPixel);
-				//     		memcpy(address, &rPixel, sizeof(GPixel));
-			 // 			}
- 			// 		}
- 			// 	}
- 			// }
- 		}
+			//Retire edges that end on this row, and step the rest to the next one
+			int kept = 0;
+			for (Edge* e : active) {
+				if (e->maxY > y + 1) {
+					e->incrementCurrX();
+					active[kept++] = e;
+				}
+			}
+			active.resize(kept);
+
+			//Edges may have crossed, insertion sort since they are almost in order
+			for (int i = 1; i < kept; i++) {
+				Edge* e = active[i];
+				int j = i;
+				for (; j > 0 && active[j - 1]->currX > e->currX; j--) {
+					active[j] = active[j - 1];
+				}
+				active[j] = e;
+			}
+			y++;
+		}
  	}
 
  	void concat(const GMatrix& matrix) {
 		this->ctm = this->ctm.preConcat(matrix);
  	}
 
- 	static Edge* clip_line(const GRect& bounds, GPoint p0, GPoint p1, Edge* edge) {
+ 	//Appends the edge made from init(p0, p1, winding) to edges, unless it covers no rows
+ 	static void add_edge(GPoint p0, GPoint p1, int winding, std::vector<Edge>& edges) {
+ 		Edge edge;
+ 		if (edge.init(p0, p1, winding)) {
+ 			edges.push_back(edge);
+ 		}
+ 	}
+
+ 	//Clips the device-space line p0 p1 into edges, after scaling its y up by 1 << shift
+ 	static void add_line(const GRect& bounds, GPoint p0, GPoint p1, int shift, std::vector<Edge>& edges) {
+ 		float scale = 1 << shift;
+ 		p0.fY *= scale;
+ 		p1.fY *= scale;
+ 		clip_line(bounds, p0, p1, edges);
+ 	}
+
+ 	static void clip_line(const GRect& bounds, GPoint p0, GPoint p1, std::vector<Edge>& edges) {
 	    if (p0.fY == p1.fY) {
-	        return edge;
+	        return;
 	    }
 
+	    int winding = 1;
 	    if (p0.fY > p1.fY) {
 	        std::swap(p0, p1);
+	        winding = -1;
 	    }
 	    // now we're monotonic in Y: p0 <= p1
 	    if (p1.fY <= bounds.top() || p0.fY >= bounds.bottom()) {
-	        return edge;
+	        return;
 	    }
 	    
 	    double dxdy = (double)(p1.fX - p0.fX) / (p1.fY - p0.fY);
@@ -561,121 +764,26 @@ public:
 
 	    if (p1.fX <= bounds.left()) {   // entirely to the left
 	        p0.fX = p1.fX = bounds.left();
-	        return edge + edge->init(p0, p1);
+	        add_edge(p0, p1, winding, edges);
+	        return;
 	    }
 	    if (p0.fX >= bounds.right()) {  // entirely to the right
 	        p0.fX = p1.fX = bounds.right();
-	        return edge + edge->init(p0, p1);
+	        add_edge(p0, p1, winding, edges);
+	        return;
 	    }
 
 	    if (p0.fX < bounds.left()) {
 	        float y = p0.fY + (bounds.left() - p0.fX) / dxdy;
-	        edge += edge->init(GPoint::Make(bounds.left(), p0.fY), GPoint::Make(bounds.left(), y));
+	        add_edge(GPoint::Make(bounds.left(), p0.fY), GPoint::Make(bounds.left(), y), winding, edges);
 	        p0.set(bounds.left(), y);
 	    }
 	    if (p1.fX > bounds.right()) {
 	        float y = p0.fY + (bounds.right() - p0.fX) / dxdy;
-	        edge += edge->init(GPoint::Make(bounds.right(), y), GPoint::Make(bounds.right(), p1.fY));
+	        add_edge(GPoint::Make(bounds.right(), y), GPoint::Make(bounds.right(), p1.fY), winding, edges);
 	        p1.set(bounds.right(), y);
 	    }
-	    return edge + edge->init(p0, p1);
-	}
-
- 	GPixel generateRPixel(GBlendMode mode, GPixel sPixel, GPixel dPixel) {
- 		GPixel rPixel;
-	    int rA;
-	    int rR;
-	    int rG;
-	    int rB;
- 		switch (mode) {
-			case GBlendMode::kClear: //!< [0, 0]
-				rPixel = GPixel_PackARGB(0, 0, 0, 0);
-				break;
-		    case GBlendMode::kSrc: //!< [Sa, Sc]
-		    	rA = GPixel_GetA(sPixel);
-		    	rR = GPixel_GetR(sPixel);
-		    	rG = GPixel_GetG(sPixel);
-		    	rB = GPixel_GetB(sPixel);
-		    	rPixel = GPixel_PackARGB(rA, rR, rG, rB);
-		    	break;
-		    case GBlendMode::kDst: //!< [Da, Dc]
-		    	rA = GPixel_GetA(dPixel);
-		    	rR = GPixel_GetR(dPixel);
-		    	rG = GPixel_GetG(dPixel);
-		    	rB = GPixel_GetB(dPixel);
-		    	rPixel = GPixel_PackARGB(rA, rR, rG, rB);
-		    	break;
-		    case GBlendMode::kSrcOver: //!< [Sa + Da * (1 - Sa), Sc + Dc * (1 - Sa)]
-		    	rA = GPixel_GetA(sPixel) + div255((255 - GPixel_GetA(sPixel)) * GPixel_GetA(dPixel));
-    			rR = GPixel_GetR(sPixel) + div255((255 - GPixel_GetA(sPixel)) * GPixel_GetR(dPixel));
-    			rG = GPixel_GetG(sPixel) + div255((255 - GPixel_GetA(sPixel)) * GPixel_GetG(dPixel));
-    			rB = GPixel_GetB(sPixel) + div255((255 - GPixel_GetA(sPixel)) * GPixel_GetB(dPixel));
-    			rPixel = GPixel_PackARGB(rA, rR, rG, rB);
-		    	break;
-		    case GBlendMode::kDstOver: //!< [Da + Sa * (1 - Da), Dc + Sc * (1 - Da)]
-			    rA = GPixel_GetA(dPixel) + div255((255 - GPixel_GetA(dPixel)) * GPixel_GetA(sPixel));
-    			rR = GPixel_GetR(dPixel) + div255((255 - GPixel_GetA(dPixel)) * GPixel_GetR(sPixel));
-    			rG = GPixel_GetG(dPixel) + div255((255 - GPixel_GetA(dPixel)) * GPixel_GetG(sPixel));
-    			rB = GPixel_GetB(dPixel) + div255((255 - GPixel_GetA(dPixel)) * GPixel_GetB(sPixel));
-    			rPixel = GPixel_PackARGB(rA, rR, rG, rB);
-		    	break;
-		    case GBlendMode::kSrcIn: //!< [Sa * Da, Sc * Da]
-		    	rA = div255(GPixel_GetA(sPixel) * GPixel_GetA(dPixel));
-		    	rR = div255(GPixel_GetR(sPixel) * GPixel_GetA(dPixel));
-		    	rG = div255(GPixel_GetG(sPixel) * GPixel_GetA(dPixel));
-		    	rB = div255(GPixel_GetB(sPixel) * GPixel_GetA(dPixel));
-		    	rPixel = GPixel_PackARGB(rA, rR, rG, rB);
-		    	break;
-		    case GBlendMode::kDstIn: //!< [Da * Sa, Dc * Sa]
-		    	rA = div255(GPixel_GetA(dPixel) * GPixel_GetA(sPixel));
-		    	rR = div255(GPixel_GetR(dPixel) * GPixel_GetA(sPixel));
-		    	rG = div255(GPixel_GetG(dPixel) * GPixel_GetA(sPixel));
-		    	rB = div255(GPixel_GetB(dPixel) * GPixel_GetA(sPixel));
-		    	rPixel = GPixel_PackARGB(rA, rR, rG, rB);
-		    	break;
-		    //Seems to have no impact 7, 8, 9 , 10
-		    case GBlendMode::kSrcOut: //!< [Sa * (1 - Da), Sc * (1 - Da)]
-		    	rA = div255(GPixel_GetA(sPixel) * (255 - GPixel_GetA(dPixel)));
-		    	rR = div255(GPixel_GetR(sPixel) * (255 - GPixel_GetA(dPixel)));
-		    	rG = div255(GPixel_GetG(sPixel) * (255 - GPixel_GetA(dPixel)));
-		    	rB = div255(GPixel_GetB(sPixel) * (255 - GPixel_GetA(dPixel)));
-		    	rPixel = GPixel_PackARGB(rA, rR, rG, rB);
-		    	break;
-		    case GBlendMode::kDstOut: //!< [Da * (1 - Sa), Dc * (1 - Sa)]
-		    	rA = div255(GPixel_GetA(dPixel) * (255 - GPixel_GetA(sPixel)));
-		    	rR = div255(GPixel_GetR(dPixel) * (255 - GPixel_GetA(sPixel)));
-		    	rG = div255(GPixel_GetG(dPixel) * (255 - GPixel_GetA(sPixel)));
-		    	rB = div255(GPixel_GetB(dPixel) * (255 - GPixel_GetA(sPixel)));
-		    	rPixel = GPixel_PackARGB(rA, rR, rG, rB);
-		    	break;
-		    case GBlendMode::kSrcATop: //!< [Da, Sc * Da + Dc * (1 - Sa)]
-		    	rA = GPixel_GetA(dPixel);
-		    	rR = div255(GPixel_GetR(sPixel) * GPixel_GetA(dPixel) + GPixel_GetR(dPixel) * (255 - GPixel_GetA(sPixel)));
-		    	rG = div255(GPixel_GetG(sPixel) * GPixel_GetA(dPixel) + GPixel_GetG(dPixel) * (255 - GPixel_GetA(sPixel)));
-		    	rB = div255(GPixel_GetB(sPixel) * GPixel_GetA(dPixel) + GPixel_GetB(dPixel) * (255 - GPixel_GetA(sPixel)));
-		    	rPixel = GPixel_PackARGB(rA, rR, rG, rB);
-		    	break;
-		    case GBlendMode::kDstATop: //!< [Sa, Dc * Sa + Sc * (1 - Da)]
-		    	rA = GPixel_GetA(sPixel);
-		    	rR = div255(GPixel_GetR(dPixel) * GPixel_GetA(sPixel) + GPixel_GetR(sPixel) * (255 - GPixel_GetA(dPixel)));
-		    	rG = div255(GPixel_GetG(dPixel) * GPixel_GetA(sPixel) + GPixel_GetG(sPixel) * (255 - GPixel_GetA(dPixel)));
-		    	rB = div255(GPixel_GetB(dPixel) * GPixel_GetA(sPixel) + GPixel_GetB(sPixel) * (255 - GPixel_GetA(dPixel)));
-		    	rPixel = GPixel_PackARGB(rA, rR, rG, rB);
-		    	break;
-		    case GBlendMode::kXor: //!< [Sa + Da - 2 * Sa * Da, Sc * (1 - Da) + Dc * (1 - Sa)]
-		    	rA = GPixel_GetA(sPixel) + GPixel_GetA(dPixel) - div255(2 * GPixel_GetA(sPixel) * GPixel_GetA(dPixel));
-		    	rR = div255(GPixel_GetR(sPixel) * (255 - GPixel_GetA(dPixel)) + GPixel_GetR(dPixel) * (255 - GPixel_GetA(sPixel)));
-		    	rG = div255(GPixel_GetG(sPixel) * (255 - GPixel_GetA(dPixel)) + GPixel_GetG(dPixel) * (255 - GPixel_GetA(sPixel)));
-		    	rB = div255(GPixel_GetB(sPixel) * (255 - GPixel_GetA(dPixel)) + GPixel_GetB(dPixel) * (255 - GPixel_GetA(sPixel)));
-		    	rPixel = GPixel_PackARGB(rA, rR, rG, rB);
-		    	break;
-		}
-		return rPixel;
- 	}
-
- 	unsigned div255(unsigned x) {
-	    x += 128;
-    	return x + (x >> 8) >> 8;
+	    add_edge(p0, p1, winding, edges);
 	}
 
 	uint64_t expand(uint32_t x) {
@@ -695,81 +803,337 @@ public:
 	}
 
 	void save() {
- 		GMatrix save(this->ctm[GMatrix::SX], this->ctm[GMatrix::KX], this->ctm[GMatrix::TX], this->ctm[GMatrix::KX], this->ctm[GMatrix::SY], this->ctm[GMatrix::TY]);
- 		this->ctmStack.push(save);
+ 		this->ctmStack.push(this->ctm);
+ 		this->clipStack.push(this->fClip);
  	}
 
  	void restore() {
  		if (this->ctmStack.empty()) {
  			//Error
- 		} else {
- 			if (this->layerStack.empty()) {
- 				//Regular save was used instead of save layer
- 				GMatrix popped = this->ctmStack.top();
- 				this->ctmStack.pop();
- 				this->ctm.set6(popped[GMatrix::SX], popped[GMatrix::KX], popped[GMatrix::TX], popped[GMatrix::KX], popped[GMatrix::SY], popped[GMatrix::TY]);
- 			} else {
- 				//Get previous layer
- 				Layer currentLayer = layerStack.top();
- 				layerStack.pop();
-
- 				//Get paint settings
- 				GFilter* fl = currentLayer.fPaint.getFilter();
- 				GBlendMode mode = currentLayer.fPaint.getBlendMode();
-
- 				//Reset CTM
- 				GMatrix layerCtm;
- 				layerCtm.set6(this->ctm[GMatrix::SX], this->ctm[GMatrix::KX], this->ctm[GMatrix::TX], this->ctm[GMatrix::KX], this->ctm[GMatrix::SY], this->ctm[GMatrix::TY]);
- 				if (currentLayer.fBounds) {
- 					layerCtm.postTranslate(currentLayer.fBounds->left(), currentLayer.fBounds->top());
+ 			return;
+ 		}
+ 		//Back to the clip of the surface below, which the layer (if any) is drawn through
+ 		this->fClip = this->clipStack.top();
+ 		this->clipStack.pop();
+ 		if (!this->layerStack.empty() && this->layerStack.top().fSaveDepth == this->ctmStack.size()) {
+ 			//This save came from saveLayer, draw the layer back onto the surface below it
+ 			Layer layer = this->layerStack.top();
+ 			this->layerStack.pop();
+ 			this->fSurfaceTop -= layer.fBounds.top();
+ 			GBitmap* dst = this->layerStack.empty() ? &this->fDevice : &this->layerStack.top().fBitmap;
+ 			this->compositeLayer(layer, dst);
+ 		}
+ 		this->ctm = this->ctmStack.top();
+ 		this->ctmStack.pop();
+ 		this->currentDevice = this->layerStack.empty() ? &this->fDevice : &this->layerStack.top().fBitmap;
+ 	}
+
+ 	void clipRect(const GRect& rect) override {
+ 		//Without rotation or skew this is just a smaller rect, rounded like drawRect rounds
+ 		if (this->ctm[GMatrix::KX] == 0 && this->ctm[GMatrix::KY] == 0) {
+ 			if (!this->fClip.fRect.intersect(this->mapRect(rect).round())) {
+ 				this->fClip.fRect = GIRect::MakeWH(0, 0);
+ 			}
+ 			return;
+ 		}
+ 		GPath path;
+ 		path.addRect(rect);
+ 		this->clipPath(path);
+ 	}
+
+ 	void clipPath(const GPath& path) override {
+ 		if (this->quickReject(this->mapRect(path.bounds()))) {
+ 			this->fClip.fRect = GIRect::MakeWH(0, 0);
+ 			return;
+ 		}
+
+ 		//Scan convert the path, keeping the parts of its spans the current clip allows
+ 		GIRect rect = this->drawableRect();
+ 		const Clip& old = this->fClip;
+ 		std::shared_ptr<ClipMask> mask(new ClipMask);
+ 		mask->fTop = rect.top();
+ 		mask->fRows.push_back(0);
+ 		int bottom = rect.top();
+ 		int left = rect.right();
+ 		int right = rect.left();
+ 		this->fillPath(path, rect.bottom(), [&](int x, int y, int count) {
+ 			if (y < rect.top() || count <= 0) {
+ 				return;
+ 			}
+ 			//Close off the rows up to this one
+ 			for (; bottom < y; bottom++) {
+ 				mask->fRows.push_back(mask->fSpans.size());
+ 			}
+ 			int l = std::max(x, rect.left());
+ 			int r = std::min(x + count, rect.right());
+ 			const int* span = nullptr;
+ 			const int* end = nullptr;
+ 			if (old.fMask) {
+ 				old.fMask->row(y + old.fMaskY, &span, &end);
+ 			}
+ 			//Without an old mask the rect is all there is to intersect with, once
+ 			int pieces = old.fMask ? (end - span) / 2 : 1;
+ 			for (int i = 0; i < pieces; i++) {
+ 				int pieceL = old.fMask ? std::max(l, span[2 * i] - old.fMaskX) : l;
+ 				int pieceR = old.fMask ? std::min(r, span[2 * i + 1] - old.fMaskX) : r;
+ 				if (pieceL >= pieceR) {
+ 					continue;
  				}
- 				GMatrix popped = this->ctmStack.top();
- 				this->ctmStack.pop();
- 				this->ctm.set6(popped[GMatrix::SX], popped[GMatrix::KX], popped[GMatrix::TX], popped[GMatrix::KX], popped[GMatrix::SY], popped[GMatrix::TY]);
- 				GPixel sPixel;
-				GPixel dPixel;
-				GPixel rPixel;
-				for (int y = 0; y < this->fDevice.height(); y++) {
-					for (int x = 0; x < this->fDevice.width(); x++) {
-						GPoint layerLocalPoint = layerCtm.mapXY(x, y);
-						int pinnedX = std::max(0, std::min(GRoundToInt(layerLocalPoint.fX), currentLayer.fBitmap.width() - 1));
-						int pinnedY = std::max(0, std::min(GRoundToInt(layerLocalPoint.fY), currentLayer.fBitmap.height() - 1));
-						GPixel* layerAddress = currentLayer.fBitmap.getAddr(pinnedX, pinnedY);
-						memcpy(&sPixel, layerAddress, sizeof(GPixel));
-						if (fl) {
-							fl->filter(&sPixel, &sPixel, 1);
-						}
-						GPixel* address = this->fDevice.getAddr(x, y);
-						memcpy(&dPixel, address, sizeof(GPixel));
-						rPixel = generateRPixel(mode, sPixel, dPixel);
-						memcpy(address, &rPixel, sizeof(GPixel));
-					}
-				}
+ 				//Runs from one row arrive left to right, so a touching run just extends the last one
+ 				if (mask->fSpans.size() > (size_t) mask->fRows.back() && mask->fSpans.back() == pieceL) {
+ 					mask->fSpans.back() = pieceR;
+ 				} else {
+ 					mask->fSpans.push_back(pieceL);
+ 					mask->fSpans.push_back(pieceR);
+ 				}
+ 				left = std::min(left, pieceL);
+ 				right = std::max(right, pieceR);
+ 			}
+ 		});
+ 		//Close off the last row that has runs; rows past it have none
+ 		mask->fRows.push_back(mask->fSpans.size());
+ 		bottom++;
+
+ 		//The rect shrinks to the runs that survived, so draws can reject or stop early against it
+ 		GIRect bounds = GIRect::MakeLTRB(left, mask->fTop, right, bottom);
+ 		if (left >= right) {
+ 			this->fClip.fRect = GIRect::MakeWH(0, 0);
+ 			return;
+ 		}
+ 		//Trim the leading empty rows
+ 		int first = 0;
+ 		while (mask->fRows[first + 1] == 0) {
+ 			first++;
+ 		}
+ 		mask->fRows.erase(mask->fRows.begin(), mask->fRows.begin() + first);
+ 		mask->fTop += first;
+ 		bounds.fTop = mask->fTop;
+
+ 		this->fClip.fRect = bounds;
+ 		this->fClip.fMask = mask;
+ 		this->fClip.fMaskX = 0;
+ 		this->fClip.fMaskY = 0;
+ 	}
 
- 				this->currentDevice = &this->fDevice;
+ 	//Blend the layer onto dst over just the rect it covers, one row at a time, through the current clip.
+ 	//The layer never extends past the clip's rect, so only a mask can cut into it.
+ 	void compositeLayer(const Layer& layer, GBitmap* dst) {
+ 		int width = layer.fBitmap.width();
+ 		if (width == 0) {
+ 			return;
+ 		}
+ 		GFilter* fl = layer.fPaint.getFilter();
+ 		GBlendMode mode = layer.fPaint.getBlendMode();
+ 		BlendRowProc blendRow = GetBlendRowProc(mode);
+ 		if (this->fRowStorage.size() < (size_t) width) {
+ 			this->fRowStorage.resize(width);
+ 		}
+
+ 		//If a transparent layer pixel (after the filter) leaves dst alone, the untouched parts of the layer can be skipped
+ 		GPixel clear = 0;
+ 		if (fl) {
+ 			fl->filter(&clear, &clear, 1);
+ 		}
+ 		bool skipClear = clear == 0 && !GetBlendConstProc(mode, clear);
+
+ 		//Only the layer rows that land in the band were drawn
+ 		int layerTop = this->fSurfaceTop + layer.fBounds.top();
+ 		int top = std::max(0, this->fBandTop - layerTop);
+ 		int bottom = std::min(layer.fBitmap.height(), this->fBandBottom - layerTop);
+ 		for (int y = top; y < bottom; y++) {
+ 			const GPixel* src = layer.fBitmap.getAddr(0, y);
+ 			int left = 0;
+ 			int right = width;
+ 			if (skipClear) {
+ 				while (left < right && src[left] == 0) {
+ 					left++;
+ 				}
+ 				while (right > left && src[right - 1] == 0) {
+ 					right--;
+ 				}
+ 				if (left == right) {
+ 					continue;
+ 				}
+ 			}
+ 			if (!this->fClip.fMask) {
+ 				this->compositeSpan(layer, dst, blendRow, y, left, right);
+ 				continue;
  			}
+ 			const int* span;
+ 			const int* end;
+ 			this->fClip.fMask->row(layer.fBounds.top() + y + this->fClip.fMaskY, &span, &end);
+ 			int dx = layer.fBounds.left() + this->fClip.fMaskX;
+ 			for (; span < end; span += 2) {
+ 				this->compositeSpan(layer, dst, blendRow, y, std::max(left, span[0] - dx), std::min(right, span[1] - dx));
+ 			}
+ 		}
+ 	}
+
+ 	//Filter and blend layer pixels [left, right) of row y onto dst
+ 	void compositeSpan(const Layer& layer, GBitmap* dst, BlendRowProc blendRow, int y, int left, int right) {
+ 		if (left >= right) {
+ 			return;
  		}
+ 		const GPixel* src = layer.fBitmap.getAddr(left, y);
+ 		if (GFilter* fl = layer.fPaint.getFilter()) {
+ 			fl->filter(this->fRowStorage.data(), src, right - left);
+ 			src = this->fRowStorage.data();
+ 		}
+ 		blendRow(dst->getAddr(layer.fBounds.left() + left, layer.fBounds.top() + y), src, right - left);
+ 	}
+
+ 	//The rows of the current surface that fall inside the band this canvas draws
+ 	void surfaceRows(int* top, int* bottom) const {
+ 		*top = std::max(0, this->fBandTop - this->fSurfaceTop);
+ 		*bottom = std::min(this->currentDevice->height(), this->fBandBottom - this->fSurfaceTop);
+ 	}
+
+ 	//True if geometry with these device bounds cannot reach a pixel center in the surface rows we draw.
+ 	//NaN bounds are never rejected, the edge walk copes with them as before.
+ 	bool quickReject(const GRect& deviceBounds) const {
+ 		GIRect rect = this->drawableRect();
+ 		return rect.isEmpty() || deviceBounds.fRight <= rect.left() || deviceBounds.fLeft >= rect.right() ||
+ 			   deviceBounds.fBottom <= rect.top() || deviceBounds.fTop >= rect.bottom();
  	}
 
- 	static void setup_bitmap(GBitmap* bitmap, int w, int h) {
-	    size_t rb = w * sizeof(GPixel);
-	    bitmap->reset(w, h, rb, (GPixel*)calloc(h, rb), GBitmap::kNo_IsOpaque);
+ 	//The part of the current surface draws may write: the clip's rect, within the band's rows
+ 	GIRect drawableRect() const {
+ 		int top, bottom;
+ 		this->surfaceRows(&top, &bottom);
+ 		GIRect rect = this->fClip.fRect;
+ 		if (!rect.intersect(GIRect::MakeLTRB(0, top, this->currentDevice->width(), bottom))) {
+ 			return GIRect::MakeWH(0, 0);
+ 		}
+ 		return rect;
+ 	}
+
+ 	//The device-space bounds of a local rect under the CTM
+ 	GRect mapRect(const GRect& rect) const {
+		GPoint corners[4];
+		corners[0] = GPoint::Make(rect.fLeft, rect.fTop);
+		corners[1] = GPoint::Make(rect.fRight, rect.fTop);
+		corners[2] = GPoint::Make(rect.fRight, rect.fBottom);
+		corners[3] = GPoint::Make(rect.fLeft, rect.fBottom);
+		this->ctm.mapPoints(corners, corners, 4);
+		return bounds_of(corners, 4);
+ 	}
+
+ 	static GRect bounds_of(const GPoint points[], int count) {
+ 		if (count <= 0) {
+ 			return GRect::MakeWH(0, 0);
+ 		}
+ 		GRect bounds = GRect::MakeLTRB(points[0].fX, points[0].fY, points[0].fX, points[0].fY);
+ 		for (int i = 1; i < count; i++) {
+ 			bounds.setLTRB(std::min(bounds.fLeft, points[i].fX), std::min(bounds.fTop, points[i].fY),
+ 						   std::max(bounds.fRight, points[i].fX), std::max(bounds.fBottom, points[i].fY));
+ 		}
+ 		return bounds;
+ 	}
+
+ 	//Resolve the paint into a blitter for the current device. Returns false if nothing should draw.
+	bool setupBlitter(const GPaint& paint, Blitter* blitter) {
+		//Get paint shader and set CTM
+		GShader* shader = paint.getShader();
+		if (shader) {
+			if (!shader->setContext(this->ctm)) {
+				return false;
+			}
+		}
+
+		//Get paint color
+		GColor color = paint.getColor().pinToUnit();
+	    int iA = GRoundToInt(GPinToUnit(color.fA) * 255);
+	    int iR = GRoundToInt(color.fR * color.fA * 255);
+	    int iG = GRoundToInt(color.fG * color.fA * 255);
+	    int iB = GRoundToInt(color.fB * color.fA * 255);
+	    GPixel sPixel = GPixel_PackARGB(iA, iR, iG, iB);
+
+	    //Get paint filter
+	    GFilter* fl = paint.getFilter();
+	    if (fl && !shader) {
+	    	fl->filter(&sPixel, &sPixel, 1);
+	    }
+
+	    GBlendMode mode = paint.getBlendMode();
+	    if (shader) {
+	    	//An opaque shader makes SrcOver the same as Src
+	    	if (mode == GBlendMode::kSrcOver && !fl && shader->isOpaque()) {
+	    		mode = GBlendMode::kSrc;
+	    	}
+	    	blitter->blendRow = GetBlendRowProc(mode);
+	    	blitter->blendConst = nullptr;
+	    } else {
+	    	//A solid color can leave the device untouched (e.g. transparent SrcOver), then skip the draw
+	    	blitter->blendRow = nullptr;
+	    	blitter->blendConst = GetBlendConstProc(mode, sPixel);
+	    	if (!blitter->blendConst) {
+	    		return false;
+	    	}
+	    }
+
+	    if (this->fRowStorage.size() < (size_t) this->currentDevice->width()) {
+	    	this->fRowStorage.resize(this->currentDevice->width());
+	    }
+	    if (paint.isAntiAlias() && this->fScratchStorage.size() < (size_t) this->currentDevice->width()) {
+	    	this->fScratchStorage.resize(this->currentDevice->width());
+	    }
+
+	    blitter->device = this->currentDevice;
+	    blitter->shader = shader;
+	    blitter->filter = fl;
+	    blitter->color = sPixel;
+	    blitter->storage = this->fRowStorage.data();
+	    blitter->scratch = this->fScratchStorage.data();
+	    GIRect rect = this->drawableRect();
+	    blitter->top = rect.top();
+	    blitter->bottom = rect.bottom();
+	    blitter->left = rect.left();
+	    blitter->right = rect.right();
+	    blitter->mask = this->fClip.fMask.get();
+	    blitter->maskX = this->fClip.fMaskX;
+	    blitter->maskY = this->fClip.fMaskY;
+	    return true;
 	}
 
 protected:
-	void onSaveLayer(const GRect* bounds, const GPaint& paint) {		save();
+	void onSaveLayer(const GRect* bounds, const GPaint& paint) {
+		//The layer only needs to cover the device-space bounds, clipped to the current surface and clip
+		GIRect layerBounds = GIRect::MakeWH(this->currentDevice->width(), this->currentDevice->height());
+		if (!layerBounds.intersect(this->fClip.fRect)) {
+			layerBounds = GIRect::MakeWH(0, 0);
+		}
 		if (bounds) {
-			if (this->layerStack.empty()) {
-				ctm.postTranslate(0 - bounds->left(), this->fDevice.height() - bounds->top());
-			} else {
-				ctm.postTranslate(this->layerStack.top().fBounds->left() - bounds->left(), this->layerStack.top().fBounds->top() - bounds->top());
+			if (!layerBounds.intersect(this->mapRect(*bounds).round())) {
+				layerBounds = GIRect::MakeWH(0, 0);
 			}
 		}
-		GBitmap newLayerBitmap;
-		setup_bitmap(&newLayerBitmap, this->fDevice.width(), this->fDevice.height());
-		Layer newLayer(newLayerBitmap, bounds, paint);
-		this->layerStack.push(newLayer);
+
+		//Layers at the same depth share pixel memory, so only a layer bigger than any before it allocates
+		size_t depth = this->layerStack.size();
+		if (this->fLayerPool.size() <= depth) {
+			this->fLayerPool.resize(depth + 1);
+		}
+		GPixel* pixels = this->fLayerPool[depth].reserve(layerBounds.width() * layerBounds.height());
+		GBitmap layerBitmap;
+		layerBitmap.reset(layerBounds.width(), layerBounds.height(), layerBounds.width() * sizeof(GPixel), pixels, GBitmap::kNo_IsOpaque);
+
+		this->save();
+		//Draw into the layer with its top-left corner at the origin
+		this->ctm.postTranslate(-layerBounds.left(), -layerBounds.top());
+		this->layerStack.push(Layer(layerBitmap, layerBounds, paint, this->ctmStack.size()));
 		this->currentDevice = &this->layerStack.top().fBitmap;
+		this->fSurfaceTop += layerBounds.top();
+		//The clip carries over into the layer's coordinates
+		this->fClip.fRect.offset(-layerBounds.left(), -layerBounds.top());
+		this->fClip.fMaskX += layerBounds.left();
+		this->fClip.fMaskY += layerBounds.top();
+
+		//Rows outside the band are never drawn or composited, so only the band needs clearing
+		int top, bottom;
+		this->surfaceRows(&top, &bottom);
+		for (int y = top; y < bottom; y++) {
+			memset(layerBitmap.getAddr(0, y), 0, layerBounds.width() * sizeof(GPixel));
+		}
 	}
 
 private:
@@ -777,13 +1141,39 @@ private:
 	GBitmap* currentDevice;
 	GMatrix ctm;
 	std::stack<GMatrix> ctmStack;
+	Clip fClip;
+	std::stack<Clip> clipStack;
 	std::stack<Layer> layerStack;
+	std::vector<GPixel> fRowStorage;
+	//Edges of the current draw; cleared per draw but never shrunk, so its capacity is reused
+	std::vector<Edge> fEdges;
+	std::vector<Edge*> fActiveEdges;
+	std::vector<GPoint> fCurvePoints;
+	//Coverage of the row being anti-aliased, see fillAntiAliased()
+	std::vector<int> fCoverage;
+	std::vector<int> fCoverageDelta;
+	std::vector<uint8_t> fCoverageRow;
+	std::vector<GPixel> fScratchStorage;
+	//Pixels for the layer at each saveLayer depth, kept around for the next layer at that depth
+	std::vector<LayerPixels> fLayerPool;
+	//Device rows [fBandTop, fBandBottom) are the only ones this canvas writes
+	int fBandTop;
+	int fBandBottom;
+	//Device row of the current surface's row 0 (the sum of the open layers' offsets)
+	int fSurfaceTop;
 };
 
 std::unique_ptr<GCanvas> GCreateCanvas(const GBitmap& device) {
     if (!device.pixels()) {
         return nullptr;
     }
-    return std::unique_ptr<GCanvas>(new EmptyCanvas(device));
+    return std::unique_ptr<GCanvas>(new EmptyCanvas(device, 0, device.height()));
+}
+
+std::unique_ptr<GCanvas> CreateBandCanvas(const GBitmap& device, int top, int bottom) {
+    if (!device.pixels()) {
+        return nullptr;
+    }
+    return std::unique_ptr<GCanvas>(new EmptyCanvas(device, std::max(0, top), std::min(device.height(), bottom)));
 }
 
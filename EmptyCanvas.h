@@ -0,0 +1,14 @@
+#ifndef EmptyCanvas_DEFINED
+#define EmptyCanvas_DEFINED
+
+#include "GCanvas.h"
+#include <memory>
+
+/**
+ *  Return a canvas like GCreateCanvas(device), except that it only writes device rows
+ *  [top, bottom). It still walks every draw's geometry from the top, exactly as a full canvas
+ *  does, so those rows come out identical to drawing with GCreateCanvas.
+ */
+std::unique_ptr<GCanvas> CreateBandCanvas(const GBitmap& device, int top, int bottom);
+
+#endif
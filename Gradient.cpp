@@ -0,0 +1,43 @@
+#include "Gradient.h"
+#include "GColor.h"
+#include "GMath.h"
+#include "GPixel.h"
+
+//Sample the colors at kLUTSize evenly spaced t, interpolating unpremul and premultiplying after
+GradientShader::GradientShader(const GColor colors[], int count, TileMode tileMode) : fColors(colors, colors + count), fTileMode(tileMode) {
+	int size = count > 1 ? kLUTSize : 1;
+	float interval = count > 1 ? 1.0f / (count - 1) : 1.0f;
+	for (int i = 0; i < size; i++) {
+		GColor color = colors[0];
+		if (count > 1) {
+			float t = (float) i / (kLUTSize - 1);
+			int colorIndex0 = std::min(GFloorToInt(t / interval), count - 2);
+			float percentage = (t - (colorIndex0 * interval)) / interval;
+			GColor color0 = colors[colorIndex0];
+			GColor color1 = colors[colorIndex0 + 1];
+			color.fA = color0.fA + percentage * (color1.fA - color0.fA);
+			color.fR = color0.fR + percentage * (color1.fR - color0.fR);
+			color.fG = color0.fG + percentage * (color1.fG - color0.fG);
+			color.fB = color0.fB + percentage * (color1.fB - color0.fB);
+		}
+		color = color.pinToUnit();
+		int iA = GRoundToInt(color.fA * 255);
+		int iR = GRoundToInt(color.fR * color.fA * 255);
+		int iG = GRoundToInt(color.fG * color.fA * 255);
+		int iB = GRoundToInt(color.fB * color.fA * 255);
+		fLUT[i] = GPixel_PackARGB(iA, iR, iG, iB);
+	}
+}
+
+size_t GradientShader::approximateBytesUsed() const {
+	return sizeof(GradientShader) + fColors.size() * sizeof(GColor);
+}
+
+bool GradientShader::isOpaque() {
+	for (const GColor& color : fColors) {
+		if (color.fA != 1.0f) {
+			return false;
+		}
+	}
+	return true;
+}
@@ -0,0 +1,56 @@
+#ifndef Gradient_DEFINED
+#define Gradient_DEFINED
+
+#include "GColor.h"
+#include "GMath.h"
+#include "GPixel.h"
+#include "GShader.h"
+#include <algorithm>
+#include <vector>
+
+/**
+ *  Shared by the linear, radial and sweep gradients. Each one maps a device pixel to a gradient
+ *  parameter t, and this turns t into a color: tile it into [0, 1] and look it up in a table of
+ *  premultiplied colors built once from the GColors.
+ */
+class GradientShader : public GShader {
+public:
+	//Entries in the color table, spread evenly over t in [0, 1]
+	static const int kLUTSize = 256;
+
+	GradientShader(const GColor colors[], int count, TileMode tileMode);
+
+	bool isOpaque() override;
+
+	size_t approximateBytesUsed() const override;
+
+	//Map the gradient parameter t back into [0, 1]
+	template <TileMode mode> static float tile(float t) {
+		switch (mode) {
+			case TileMode::kClamp:
+				return std::min(std::max(t, 0.0f), 1.0f);
+			case TileMode::kRepeat:
+				return t - GFloorToInt(t);
+			case TileMode::kMirror:
+				t = t * 0.5f;
+				t = t - GFloorToInt(t);
+				if (t > 0.5f) {
+					t = 1 - t;
+				}
+				return t * 2;
+		}
+		return 0;
+	}
+
+	template <TileMode mode> GPixel lookup(float t) const {
+		return fLUT[GRoundToInt(tile<mode>(t) * (kLUTSize - 1))];
+	}
+
+protected:
+	std::vector<GColor> fColors;
+	TileMode fTileMode;
+	//Premultiplied colors at t = i / (kLUTSize - 1), or just the one color if there is only one
+	GPixel fLUT[kLUTSize];
+};
+
+#endif
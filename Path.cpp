@@ -6,6 +6,7 @@
 #include <vector>
 #include <iostream>
 #include <cmath>
+#include <limits>
 
 GPath& GPath::addRect(const GRect& rect, GPath::Direction direction) {
 	if (direction == GPath::Direction::kCW_Direction) {
@@ -0,0 +1,348 @@
+#include "GPicture.h"
+#include "GCanvas.h"
+#include "GFilter.h"
+#include "GMatrix.h"
+#include "GPaint.h"
+#include "GPath.h"
+#include "GPoint.h"
+#include "GRect.h"
+#include "GShader.h"
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
+
+//Every recorded call is one of these, followed by its own fields (and for polygons, its points).
+//fSize is the distance to the next op, so playback just walks the buffer.
+struct Op {
+	enum Type : uint8_t {
+		kSave,
+		kSaveLayer,
+		kRestore,
+		kConcat,
+		kClipRect,
+		kClipPath,
+		kDrawPaint,
+		kDrawRect,
+		kDrawPolygon,
+		kDrawPath,
+	};
+
+	Type fType;
+	uint32_t fSize;
+};
+
+struct SaveLayerOp: Op {
+	GPaint fPaint;
+	GRect fBounds;
+	bool fHasBounds;
+};
+
+struct ConcatOp: Op {
+	GMatrix fMatrix;
+};
+
+struct ClipRectOp: Op {
+	GRect fRect;
+};
+
+//The path lives in the picture's fPaths
+struct ClipPathOp: Op {
+	int fIndex;
+};
+
+struct DrawPaintOp: Op {
+	GPaint fPaint;
+};
+
+struct DrawRectOp: Op {
+	GPaint fPaint;
+	GRect fRect;
+};
+
+//Followed by fCount GPoints
+struct DrawPolygonOp: Op {
+	GPaint fPaint;
+	int fCount;
+};
+
+//The path itself lives in the picture's fPaths
+struct DrawPathOp: Op {
+	GPaint fPaint;
+	int fIndex;
+};
+
+//Ops are packed back to back, each starting on this alignment
+static const size_t kOpAlign = alignof(void*);
+
+static size_t align_op(size_t size) {
+	return (size + kOpAlign - 1) & ~(kOpAlign - 1);
+}
+
+//A growable run of ops. The ops are plain data, so growing just copies the bytes.
+class OpBuffer {
+public:
+	template <typename T> T* push(Op::Type type, size_t extra = 0) {
+		static_assert(alignof(T) <= kOpAlign, "op is over-aligned");
+		static_assert(std::is_trivially_copyable<T>::value, "op must be plain data");
+		size_t size = align_op(sizeof(T) + extra);
+		if (fUsed + size > fCapacity) {
+			this->grow(fUsed + size);
+		}
+		T* op = new (fStorage.get() + fUsed) T;
+		op->fType = type;
+		op->fSize = size;
+		fUsed += size;
+		fCount++;
+		return op;
+	}
+
+	//Hand over the ops, trimmed to the bytes in use, and start over empty
+	std::unique_ptr<char[]> detach(size_t* used, int* count) {
+		std::unique_ptr<char[]> ops(new char[fUsed]);
+		if (fUsed > 0) {
+			memcpy(ops.get(), fStorage.get(), fUsed);
+		}
+		*used = fUsed;
+		*count = fCount;
+		fUsed = 0;
+		fCount = 0;
+		return ops;
+	}
+
+private:
+	void grow(size_t needed) {
+		fCapacity = std::max(needed, std::max(fCapacity * 2, (size_t) 4096));
+		std::unique_ptr<char[]> storage(new char[fCapacity]);
+		if (fUsed > 0) {
+			memcpy(storage.get(), fStorage.get(), fUsed);
+		}
+		fStorage = std::move(storage);
+	}
+
+	std::unique_ptr<char[]> fStorage;
+	size_t fCapacity = 0;
+	size_t fUsed = 0;
+	int fCount = 0;
+};
+
+class Picture: public GPicture {
+public:
+
+	Picture(std::unique_ptr<char[]> ops, size_t bytes, int count, std::vector<GPath> paths,
+			std::vector<std::unique_ptr<GShader>> shaders, std::vector<std::unique_ptr<GFilter>> filters)
+		: fOps(std::move(ops)), fBytes(bytes), fCount(count), fPaths(std::move(paths)),
+		  fShaders(std::move(shaders)), fFilters(std::move(filters)) {}
+
+	void playback(GCanvas* canvas) const override {
+		//The recording is balanced, so this save leaves the canvas as we found it
+		canvas->save();
+		const char* end = fOps.get() + fBytes;
+		for (const char* p = fOps.get(); p < end; p += ((const Op*) p)->fSize) {
+			switch (((const Op*) p)->fType) {
+				case Op::kSave:
+					canvas->save();
+					break;
+				case Op::kSaveLayer: {
+					const SaveLayerOp* op = (const SaveLayerOp*) p;
+					canvas->saveLayer(op->fHasBounds ? &op->fBounds : nullptr, op->fPaint);
+					break;
+				}
+				case Op::kRestore:
+					canvas->restore();
+					break;
+				case Op::kConcat:
+					canvas->concat(((const ConcatOp*) p)->fMatrix);
+					break;
+				case Op::kClipRect:
+					canvas->clipRect(((const ClipRectOp*) p)->fRect);
+					break;
+				case Op::kClipPath:
+					canvas->clipPath(fPaths[((const ClipPathOp*) p)->fIndex]);
+					break;
+				case Op::kDrawPaint:
+					canvas->drawPaint(((const DrawPaintOp*) p)->fPaint);
+					break;
+				case Op::kDrawRect: {
+					const DrawRectOp* op = (const DrawRectOp*) p;
+					canvas->drawRect(op->fRect, op->fPaint);
+					break;
+				}
+				case Op::kDrawPolygon: {
+					const DrawPolygonOp* op = (const DrawPolygonOp*) p;
+					canvas->drawConvexPolygon((const GPoint*) (op + 1), op->fCount, op->fPaint);
+					break;
+				}
+				case Op::kDrawPath: {
+					const DrawPathOp* op = (const DrawPathOp*) p;
+					canvas->drawPath(fPaths[op->fIndex], op->fPaint);
+					break;
+				}
+			}
+		}
+		canvas->restore();
+	}
+
+	int countCommands() const override {
+		return fCount;
+	}
+
+	size_t approximateBytesUsed() const override {
+		size_t bytes = sizeof(Picture) + fBytes + fPaths.size() * sizeof(GPath);
+		for (const GPath& path : fPaths) {
+			bytes += path.countPoints() * (sizeof(GPoint) + sizeof(GPath::Verb));
+		}
+		for (const std::unique_ptr<GShader>& shader : fShaders) {
+			bytes += shader->approximateBytesUsed();
+		}
+		for (const std::unique_ptr<GFilter>& filter : fFilters) {
+			bytes += filter->approximateBytesUsed();
+		}
+		return bytes;
+	}
+
+private:
+	std::unique_ptr<char[]> fOps;
+	size_t fBytes;
+	int fCount;
+	std::vector<GPath> fPaths;
+	std::vector<std::unique_ptr<GShader>> fShaders;
+	std::vector<std::unique_ptr<GFilter>> fFilters;
+};
+
+class RecordingCanvas: public GRecordingCanvas {
+public:
+
+	void save() override {
+		fOps.push<Op>(Op::kSave);
+		fSaveDepth++;
+	}
+
+	void restore() override {
+		if (fSaveDepth == 0) {
+			//Error
+			return;
+		}
+		fOps.push<Op>(Op::kRestore);
+		fSaveDepth--;
+	}
+
+	void concat(const GMatrix& matrix) override {
+		fOps.push<ConcatOp>(Op::kConcat)->fMatrix = matrix;
+	}
+
+	void clipRect(const GRect& rect) override {
+		fOps.push<ClipRectOp>(Op::kClipRect)->fRect = rect;
+	}
+
+	void clipPath(const GPath& path) override {
+		fOps.push<ClipPathOp>(Op::kClipPath)->fIndex = fPaths.size();
+		fPaths.push_back(path);
+	}
+
+	void drawPaint(const GPaint& paint) override {
+		fOps.push<DrawPaintOp>(Op::kDrawPaint)->fPaint = this->keepAlive(paint);
+	}
+
+	void drawRect(const GRect& rect, const GPaint& paint) override {
+		DrawRectOp* op = fOps.push<DrawRectOp>(Op::kDrawRect);
+		op->fPaint = this->keepAlive(paint);
+		op->fRect = rect;
+	}
+
+	void drawConvexPolygon(const GPoint points[], int count, const GPaint& paint) override {
+		if (count < 0) {
+			count = 0;
+		}
+		DrawPolygonOp* op = fOps.push<DrawPolygonOp>(Op::kDrawPolygon, count * sizeof(GPoint));
+		op->fPaint = this->keepAlive(paint);
+		op->fCount = count;
+		if (count > 0) {
+			memcpy(op + 1, points, count * sizeof(GPoint));
+		}
+	}
+
+	void drawPath(const GPath& path, const GPaint& paint) override {
+		DrawPathOp* op = fOps.push<DrawPathOp>(Op::kDrawPath);
+		op->fPaint = this->keepAlive(paint);
+		op->fIndex = fPaths.size();
+		fPaths.push_back(path);
+	}
+
+	std::unique_ptr<GPicture> finishRecording() override {
+		while (fSaveDepth > 0) {
+			this->restore();
+		}
+		size_t bytes;
+		int count;
+		std::unique_ptr<char[]> ops = fOps.detach(&bytes, &count);
+		std::unique_ptr<GPicture> picture(new Picture(std::move(ops), bytes, count, std::move(fPaths),
+													  std::move(fShaders), std::move(fFilters)));
+		fPaths.clear();
+		fShaders.clear();
+		fFilters.clear();
+		fShaderClones.clear();
+		fFilterClones.clear();
+		return picture;
+	}
+
+protected:
+	void onSaveLayer(const GRect* bounds, const GPaint& paint) override {
+		SaveLayerOp* op = fOps.push<SaveLayerOp>(Op::kSaveLayer);
+		op->fPaint = this->keepAlive(paint);
+		op->fHasBounds = bounds != nullptr;
+		op->fBounds = bounds ? *bounds : GRect::MakeWH(0, 0);
+		fSaveDepth++;
+	}
+
+private:
+	//Swap in our own clones, so the picture does not depend on the caller's shader and filter.
+	//Each one is cloned once per recording, however many draws use it.
+	GPaint keepAlive(const GPaint& paint) {
+		GPaint kept = paint;
+		if (GShader* shader = paint.getShader()) {
+			auto it = fShaderClones.find(shader->uniqueID());
+			if (it == fShaderClones.end()) {
+				std::unique_ptr<GShader> clone = shader->clone();
+				it = fShaderClones.emplace(shader->uniqueID(), clone.get()).first;
+				if (clone) {
+					fShaders.push_back(std::move(clone));
+				}
+			}
+			if (it->second) {
+				kept.setShader(it->second);
+			}
+		}
+		if (GFilter* filter = paint.getFilter()) {
+			auto it = fFilterClones.find(filter->uniqueID());
+			if (it == fFilterClones.end()) {
+				std::unique_ptr<GFilter> clone = filter->clone();
+				it = fFilterClones.emplace(filter->uniqueID(), clone.get()).first;
+				if (clone) {
+					fFilters.push_back(std::move(clone));
+				}
+			}
+			if (it->second) {
+				kept.setFilter(it->second);
+			}
+		}
+		return kept;
+	}
+
+	OpBuffer fOps;
+	int fSaveDepth = 0;
+	std::vector<GPath> fPaths;
+	std::vector<std::unique_ptr<GShader>> fShaders;
+	std::vector<std::unique_ptr<GFilter>> fFilters;
+	//The clone made for each caller's shader and filter, by uniqueID(), or null if it has none
+	std::unordered_map<uint32_t, GShader*> fShaderClones;
+	std::unordered_map<uint32_t, GFilter*> fFilterClones;
+};
+
+std::unique_ptr<GRecordingCanvas> GCreateRecordingCanvas() {
+	return std::unique_ptr<GRecordingCanvas>(new RecordingCanvas());
+}
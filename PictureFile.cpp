@@ -0,0 +1,523 @@
+#include "GPicture.h"
+#include "GCanvas.h"
+#include "GMatrix.h"
+#include "GPaint.h"
+#include "GPath.h"
+#include "GPoint.h"
+#include "GRect.h"
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+//File layout. Every field is 4 bytes, little-endian, so commands stay 4-byte aligned in the file.
+//
+//  header:  "GPIC", uint32 version, uint32 command count, uint32 bytes of commands after the header
+//  command: uint32 type, uint32 bytes including these two fields, then by type
+//      kSave, kRestore     nothing
+//      kSaveLayer          paint, uint32 has bounds, float[4] bounds
+//      kConcat             float[6] matrix
+//      kDrawPaint          paint
+//      kDrawRect           paint, float[4] rect
+//      kDrawPolygon        paint, uint32 point count, float[2] per point
+//      kDrawPath           paint, path
+//      kClipRect           float[4] rect
+//      kClipPath           path
+//  paint:   float[4] color as A, R, G, B, uint32 GBlendMode | kPaintAntiAlias if anti-aliased
+//  rect:    left, top, right, bottom
+//  path:    uint32 verb count, uint32 point count, float[2] per point, then the verbs as uint8
+//           GPath::Verbs, padded to 4 bytes
+//
+//Bump kVersion whenever this changes.
+static const char kMagic[4] = { 'G', 'P', 'I', 'C' };
+static const uint32_t kVersion = 1;
+static const size_t kHeaderSize = 16;
+static const size_t kPaintSize = 20;
+static const uint32_t kPaintAntiAlias = 1 << 8;
+
+enum FileCommand : uint32_t {
+	kSave,
+	kSaveLayer,
+	kRestore,
+	kConcat,
+	kDrawPaint,
+	kDrawRect,
+	kDrawPolygon,
+	kDrawPath,
+	kClipRect,
+	kClipPath,
+};
+
+//The points that follow each verb in the file (a path's first point comes with its kMove)
+static int verb_points(uint8_t verb) {
+	switch (verb) {
+		case GPath::kMove:
+		case GPath::kLine:
+			return 1;
+		case GPath::kQuad:
+			return 2;
+		case GPath::kCubic:
+			return 3;
+	}
+	return -1;
+}
+
+//Store value at p as a little-endian word, whatever the host's byte order
+static void put32(char* p, uint32_t value) {
+	p[0] = (char) value;
+	p[1] = (char) (value >> 8);
+	p[2] = (char) (value >> 16);
+	p[3] = (char) (value >> 24);
+}
+
+//A canvas that appends its calls to a buffer in the file layout
+class PictureWriter: public GCanvas {
+public:
+
+	PictureWriter() {
+		fData.reserve(4096);
+		fData.insert(fData.end(), kMagic, kMagic + 4);
+		this->write32(kVersion);
+		this->write32(0);
+		this->write32(0);
+	}
+
+	//False once a call could not be written
+	bool ok() const {
+		return fOK;
+	}
+
+	//The finished file
+	const std::vector<char>& data() {
+		put32(&fData[8], fCount);
+		put32(&fData[12], fData.size() - kHeaderSize);
+		return fData;
+	}
+
+	void save() override {
+		this->endCommand(this->beginCommand(kSave));
+	}
+
+	void restore() override {
+		this->endCommand(this->beginCommand(kRestore));
+	}
+
+	void concat(const GMatrix& matrix) override {
+		size_t start = this->beginCommand(kConcat);
+		for (int i = 0; i < 6; i++) {
+			this->writeFloat(matrix[i]);
+		}
+		this->endCommand(start);
+	}
+
+	void clipRect(const GRect& rect) override {
+		size_t start = this->beginCommand(kClipRect);
+		this->writeRect(rect);
+		this->endCommand(start);
+	}
+
+	void clipPath(const GPath& path) override {
+		size_t start = this->beginCommand(kClipPath);
+		this->writePath(path);
+		this->endCommand(start);
+	}
+
+	void drawPaint(const GPaint& paint) override {
+		size_t start = this->beginCommand(kDrawPaint);
+		this->writePaint(paint);
+		this->endCommand(start);
+	}
+
+	void drawRect(const GRect& rect, const GPaint& paint) override {
+		size_t start = this->beginCommand(kDrawRect);
+		this->writePaint(paint);
+		this->writeRect(rect);
+		this->endCommand(start);
+	}
+
+	void drawConvexPolygon(const GPoint points[], int count, const GPaint& paint) override {
+		count = count > 0 ? count : 0;
+		size_t start = this->beginCommand(kDrawPolygon);
+		this->writePaint(paint);
+		this->write32(count);
+		for (int i = 0; i < count; i++) {
+			this->writeFloat(points[i].fX);
+			this->writeFloat(points[i].fY);
+		}
+		this->endCommand(start);
+	}
+
+	void drawPath(const GPath& path, const GPaint& paint) override {
+		size_t start = this->beginCommand(kDrawPath);
+		this->writePaint(paint);
+		this->writePath(path);
+		this->endCommand(start);
+	}
+
+protected:
+	void onSaveLayer(const GRect* bounds, const GPaint& paint) override {
+		size_t start = this->beginCommand(kSaveLayer);
+		this->writePaint(paint);
+		this->write32(bounds != nullptr);
+		this->writeRect(bounds ? *bounds : GRect::MakeWH(0, 0));
+		this->endCommand(start);
+	}
+
+private:
+	void writePath(const GPath& path) {
+		//GPath only hands out its points through Iter, a verb at a time
+		fVerbs.clear();
+		fPoints.clear();
+		GPath::Iter iter(path);
+		GPoint pts[4];
+		GPath::Verb verb;
+		while ((verb = iter.next(pts)) != GPath::kDone) {
+			fVerbs.push_back(verb);
+			int first = verb == GPath::kMove ? 0 : 1;
+			fPoints.insert(fPoints.end(), pts + first, pts + first + verb_points(verb));
+		}
+
+		this->write32(fVerbs.size());
+		this->write32(fPoints.size());
+		for (const GPoint& p : fPoints) {
+			this->writeFloat(p.fX);
+			this->writeFloat(p.fY);
+		}
+		fData.insert(fData.end(), fVerbs.begin(), fVerbs.end());
+		fData.resize((fData.size() + 3) & ~3, 0);
+	}
+
+	size_t beginCommand(FileCommand type) {
+		size_t start = fData.size();
+		this->write32(type);
+		this->write32(0);
+		fCount++;
+		return start;
+	}
+
+	void endCommand(size_t start) {
+		put32(&fData[start + 4], fData.size() - start);
+	}
+
+	void write32(uint32_t value) {
+		char bytes[4];
+		put32(bytes, value);
+		fData.insert(fData.end(), bytes, bytes + 4);
+	}
+
+	void writeFloat(float value) {
+		uint32_t bits;
+		memcpy(&bits, &value, 4);
+		this->write32(bits);
+	}
+
+	void writeRect(const GRect& rect) {
+		this->writeFloat(rect.fLeft);
+		this->writeFloat(rect.fTop);
+		this->writeFloat(rect.fRight);
+		this->writeFloat(rect.fBottom);
+	}
+
+	void writePaint(const GPaint& paint) {
+		if (paint.getShader() || paint.getFilter()) {
+			fOK = false;
+		}
+		const GColor& color = paint.getColor();
+		this->writeFloat(color.fA);
+		this->writeFloat(color.fR);
+		this->writeFloat(color.fG);
+		this->writeFloat(color.fB);
+		this->write32((uint32_t) paint.getBlendMode() | (paint.isAntiAlias() ? kPaintAntiAlias : 0));
+	}
+
+	std::vector<char> fData;
+	uint32_t fCount = 0;
+	bool fOK = true;
+	//Scratch for writePath
+	std::vector<uint8_t> fVerbs;
+	std::vector<GPoint> fPoints;
+};
+
+bool GWritePicture(const GPicture& picture, const char path[]) {
+	PictureWriter writer;
+	picture.playback(&writer);
+	if (!writer.ok()) {
+		return false;
+	}
+	const std::vector<char>& data = writer.data();
+	FILE* file = fopen(path, "wb");
+	if (!file) {
+		return false;
+	}
+	bool written = fwrite(data.data(), 1, data.size(), file) == data.size();
+	return fclose(file) == 0 && written;
+}
+
+//The little-endian word at p
+static uint32_t read32(const char* p) {
+	const uint8_t* bytes = (const uint8_t*) p;
+	return bytes[0] | (bytes[1] << 8) | (bytes[2] << 16) | ((uint32_t) bytes[3] << 24);
+}
+
+static float readFloat(const char* p) {
+	uint32_t bits = read32(p);
+	float value;
+	memcpy(&value, &bits, 4);
+	return value;
+}
+
+//True if the host stores words in the file's byte order, so the file's floats can be used in place
+static bool host_is_little_endian() {
+	uint32_t one = 1;
+	uint8_t first;
+	memcpy(&first, &one, 1);
+	return first == 1;
+}
+
+static GRect readRect(const char* p) {
+	return GRect::MakeLTRB(readFloat(p), readFloat(p + 4), readFloat(p + 8), readFloat(p + 12));
+}
+
+static GPaint readPaint(const char* p) {
+	GPaint paint(GColor::MakeARGB(readFloat(p), readFloat(p + 4), readFloat(p + 8), readFloat(p + 12)));
+	uint32_t flags = read32(p + 16);
+	paint.setBlendMode((GBlendMode) (flags & ~kPaintAntiAlias));
+	paint.setAntiAlias((flags & kPaintAntiAlias) != 0);
+	return paint;
+}
+
+static bool valid_paint(const char* p) {
+	return (read32(p + 16) & ~kPaintAntiAlias) <= (uint32_t) GBlendMode::kXor;
+}
+
+//Rebuild a (validated) path from its fields into path, reusing its storage
+static void read_path(const char* p, GPath* path) {
+	uint32_t verbs = read32(p);
+	uint32_t points = read32(p + 4);
+	const char* pt = p + 8;
+	const uint8_t* verb = (const uint8_t*) (pt + points * 8);
+	path->reset();
+	for (uint32_t i = 0; i < verbs; i++) {
+		switch (verb[i]) {
+			case GPath::kMove:
+				path->moveTo(readFloat(pt), readFloat(pt + 4));
+				break;
+			case GPath::kLine:
+				path->lineTo(readFloat(pt), readFloat(pt + 4));
+				break;
+			case GPath::kQuad:
+				path->quadTo(readFloat(pt), readFloat(pt + 4), readFloat(pt + 8), readFloat(pt + 12));
+				break;
+			case GPath::kCubic:
+				path->cubicTo(readFloat(pt), readFloat(pt + 4), readFloat(pt + 8), readFloat(pt + 12),
+							  readFloat(pt + 16), readFloat(pt + 20));
+				break;
+		}
+		pt += verb_points(verb[i]) * 8;
+	}
+}
+
+//Check that a path's fields take up exactly size bytes, with verbs that use exactly its points
+static bool valid_path(const char* p, uint64_t size) {
+	if (size < 8) {
+		return false;
+	}
+	uint64_t verbs = read32(p);
+	uint64_t points = read32(p + 4);
+	if (size != 8 + points * 8 + ((verbs + 3) & ~3)) {
+		return false;
+	}
+	//Every path starts with a kMove
+	const uint8_t* verb = (const uint8_t*) (p + 8 + points * 8);
+	uint64_t used = 0;
+	for (uint64_t i = 0; i < verbs; i++) {
+		int n = verb_points(verb[i]);
+		if (n < 0 || (i == 0 && verb[i] != GPath::kMove)) {
+			return false;
+		}
+		used += n;
+	}
+	return used == points;
+}
+
+//Check that one command's fields fit in its size and hold sensible values, so playback can trust it
+static bool valid_command(const char* p, uint32_t size) {
+	p += 8;
+	switch (read32(p - 8)) {
+		case kSave:
+		case kRestore:
+			return size == 8;
+		case kSaveLayer:
+			return size == 8 + kPaintSize + 20 && valid_paint(p);
+		case kConcat:
+			return size == 8 + 24;
+		case kDrawPaint:
+			return size == 8 + kPaintSize && valid_paint(p);
+		case kDrawRect:
+			return size == 8 + kPaintSize + 16 && valid_paint(p);
+		case kDrawPolygon: {
+			if (size < 8 + kPaintSize + 4 || !valid_paint(p)) {
+				return false;
+			}
+			uint64_t count = read32(p + kPaintSize);
+			return size == 8 + kPaintSize + 4 + count * 8;
+		}
+		case kDrawPath:
+			return size >= 8 + kPaintSize && valid_paint(p) &&
+				   valid_path(p + kPaintSize, size - 8 - kPaintSize);
+		case kClipRect:
+			return size == 8 + 16;
+		case kClipPath:
+			return valid_path(p, size - 8);
+	}
+	return false;
+}
+
+//A picture that reads its commands straight out of a mapped file
+class MappedPicture: public GPicture {
+public:
+
+	MappedPicture(void* mapping, size_t size) : fMapping(mapping), fSize(size) {
+		fCount = read32((const char*) mapping + 8);
+		fCommands = (const char*) mapping + kHeaderSize;
+		fBytes = read32((const char*) mapping + 12);
+	}
+
+	~MappedPicture() {
+		munmap(fMapping, fSize);
+	}
+
+	//Walk the commands once, checking each, so playback never has to
+	bool validate() const {
+		if (memcmp(fMapping, kMagic, 4) != 0 || read32((const char*) fMapping + 4) != kVersion ||
+			fBytes != fSize - kHeaderSize) {
+			return false;
+		}
+		uint32_t count = 0;
+		int depth = 0;
+		for (size_t offset = 0; offset < fBytes; count++) {
+			if (fBytes - offset < 8) {
+				return false;
+			}
+			const char* p = fCommands + offset;
+			uint32_t size = read32(p + 4);
+			if (size < 8 || size % 4 != 0 || size > fBytes - offset || !valid_command(p, size)) {
+				return false;
+			}
+			//Playback must leave the canvas as it found it
+			uint32_t type = read32(p);
+			depth += type == kSave || type == kSaveLayer;
+			depth -= type == kRestore;
+			if (depth < 0) {
+				return false;
+			}
+			offset += size;
+		}
+		return count == fCount && depth == 0;
+	}
+
+	void playback(GCanvas* canvas) const override {
+		//Paths are rebuilt here for each kDrawPath and kClipPath; reset() keeps the storage, so it only grows.
+		//Likewise the polygon points, on hosts that cannot use the file's in place.
+		static const bool kLittleEndianHost = host_is_little_endian();
+		GPath path;
+		std::vector<GPoint> points;
+		canvas->save();
+		const char* end = fCommands + fBytes;
+		for (const char* p = fCommands; p < end; p += read32(p + 4)) {
+			const char* fields = p + 8;
+			switch (read32(p)) {
+				case kSave:
+					canvas->save();
+					break;
+				case kSaveLayer: {
+					GRect bounds = readRect(fields + kPaintSize + 4);
+					canvas->saveLayer(read32(fields + kPaintSize) ? &bounds : nullptr, readPaint(fields));
+					break;
+				}
+				case kRestore:
+					canvas->restore();
+					break;
+				case kConcat:
+					canvas->concat(GMatrix(readFloat(fields), readFloat(fields + 4), readFloat(fields + 8),
+										   readFloat(fields + 12), readFloat(fields + 16), readFloat(fields + 20)));
+					break;
+				case kDrawPaint:
+					canvas->drawPaint(readPaint(fields));
+					break;
+				case kDrawRect:
+					canvas->drawRect(readRect(fields + kPaintSize), readPaint(fields));
+					break;
+				case kDrawPolygon: {
+					//The points are 4-byte aligned floats in the mapping, so a little-endian host uses them in place
+					uint32_t count = read32(fields + kPaintSize);
+					const char* pt = fields + kPaintSize + 4;
+					if (!kLittleEndianHost) {
+						points.resize(count);
+						for (uint32_t i = 0; i < count; i++) {
+							points[i].set(readFloat(pt + i * 8), readFloat(pt + i * 8 + 4));
+						}
+						pt = (const char*) points.data();
+					}
+					canvas->drawConvexPolygon((const GPoint*) pt, count, readPaint(fields));
+					break;
+				}
+				case kDrawPath:
+					read_path(fields + kPaintSize, &path);
+					canvas->drawPath(path, readPaint(fields));
+					break;
+				case kClipRect:
+					canvas->clipRect(readRect(fields));
+					break;
+				case kClipPath:
+					read_path(fields, &path);
+					canvas->clipPath(path);
+					break;
+			}
+		}
+		canvas->restore();
+	}
+
+	int countCommands() const override {
+		return fCount;
+	}
+
+	size_t approximateBytesUsed() const override {
+		return sizeof(MappedPicture) + fSize;
+	}
+
+private:
+	void* fMapping;
+	size_t fSize;
+	const char* fCommands;
+	uint32_t fBytes;
+	uint32_t fCount;
+};
+
+std::unique_ptr<GPicture> GReadPicture(const char path[]) {
+	int fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		return nullptr;
+	}
+	struct stat info;
+	if (fstat(fd, &info) != 0 || info.st_size < (off_t) kHeaderSize) {
+		close(fd);
+		return nullptr;
+	}
+	void* mapping = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	//The mapping outlives the descriptor
+	close(fd);
+	if (mapping == MAP_FAILED) {
+		return nullptr;
+	}
+	std::unique_ptr<MappedPicture> picture(new MappedPicture(mapping, info.st_size));
+	if (!picture->validate()) {
+		return nullptr;
+	}
+	return std::move(picture);
+}
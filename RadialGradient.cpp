@@ -0,0 +1,83 @@
+#include "GColor.h"
+#include "GShader.h"
+#include "GMatrix.h"
+#include "GPoint.h"
+#include "GMath.h"
+#include "GPixel.h"
+#include "Gradient.h"
+#include <cmath>
+#include <memory>
+
+class MyRadialGradient: public GradientShader {
+public:
+
+	MyRadialGradient(GPoint center, float radius, const GColor colors[], int count, GShader::TileMode tileMode) : GradientShader(colors, count, tileMode), fCenter(center), fRadius(radius) {
+		//Maps the unit circle onto the gradient's circle
+		this->fLocalMatrix.set6(radius, 0, center.fX, 0, radius, center.fY);
+	}
+
+	bool setContext(const GMatrix& ctm) {
+		GMatrix tmp;
+		tmp.setConcat(ctm, this->fLocalMatrix);
+		if (!tmp.invert(&this->fInverse)) {
+			return false;
+		}
+		//With one color only fLUT[0] is filled, so every pixel is that color
+		if (this->fColors.size() == 1) {
+			this->fShadeProc = shade_solid;
+			return true;
+		}
+		switch (this->fTileMode) {
+			case TileMode::kClamp:
+				this->fShadeProc = shade_radial<TileMode::kClamp>;
+				break;
+			case TileMode::kRepeat:
+				this->fShadeProc = shade_radial<TileMode::kRepeat>;
+				break;
+			case TileMode::kMirror:
+				this->fShadeProc = shade_radial<TileMode::kMirror>;
+				break;
+		}
+		return true;
+	}
+
+	void shadeRow(int x, int y, int count, GPixel row[]) {
+		this->fShadeProc(*this, x, y, count, row);
+	}
+
+	std::unique_ptr<GShader> clone() const {
+		return std::unique_ptr<GShader>(new MyRadialGradient(this->fCenter, this->fRadius, this->fColors.data(), this->fColors.size(), this->fTileMode));
+	}
+
+	//t is the distance from the center in the unit circle's space, stepping the local point along the row
+	template <TileMode mode> static void shade_radial(const MyRadialGradient& shader, int x, int y, int count, GPixel row[]) {
+		GPoint local = shader.fInverse.mapXY(x + 0.5f, y + 0.5f);
+		float dx = shader.fInverse[GMatrix::SX];
+		float dy = shader.fInverse[GMatrix::KY];
+		for (int i = 0; i < count; i++) {
+			row[i] = shader.lookup<mode>(sqrtf(local.fX * local.fX + local.fY * local.fY));
+			local.fX += dx;
+			local.fY += dy;
+		}
+	}
+
+	static void shade_solid(const MyRadialGradient& shader, int x, int y, int count, GPixel row[]) {
+		for (int i = 0; i < count; i++) {
+			row[i] = shader.fLUT[0];
+		}
+	}
+
+private:
+	GPoint fCenter;
+	float fRadius;
+	GMatrix fInverse;
+	GMatrix fLocalMatrix;
+	void (*fShadeProc)(const MyRadialGradient&, int x, int y, int count, GPixel row[]);
+};
+
+std::unique_ptr<GShader> GCreateRadialGradient(GPoint center, float radius, const GColor colors[], int count, GShader::TileMode tileMode) {
+	if (count < 1 || !(radius > 0)) {
+		return nullptr;
+	}
+	return std::unique_ptr<GShader>(new MyRadialGradient(center, radius, colors, count, tileMode));
+}
@@ -5,16 +5,20 @@
 #include "GPoint.h"
 #include "GMath.h"
 #include "GPixel.h"
+#include "Bilerp.h"
 #include <tgmath.h>
+#include <algorithm>
+#include <cstring>
 #include <iostream>
 #include <memory>
+#include <vector>
 #include <sys/stat.h>
 #include <unistd.h>
 
 class MyShader: public GShader {
 public:
 
-	MyShader(const GBitmap& bitmap, const GMatrix& localInv,  GShader::TileMode tileMode) : fBitmap(bitmap), fLocalInv(localInv), fTileMode(tileMode) {
+	MyShader(const GBitmap& bitmap, const GMatrix& localInv,  GShader::TileMode tileMode, GShader::FilterQuality quality) : fBitmap(bitmap), fLocalInv(localInv), fTileMode(tileMode), fQuality(quality) {
 		localInv.invert(&this->fLocalMatrix);
 		// std::cout << "Constructor: \n";
 		// switch (this->fTileMode) {
@@ -39,82 +43,316 @@ public:
 	bool setContext(const GMatrix& ctm) {
         GMatrix tmp;
         tmp.setConcat(ctm, this->fLocalMatrix);
-        if (tmp.invert(&this->fInverse)) {
-   //      	std::cout << "Prescale this->fInverse\n";
-   //      	std::cout << "[" << this->fInverse[0] << ", " <<  this->fInverse[1] << ", " << this->fInverse[2] << "]\n";
-			// std::cout << "[" << this->fInverse[3] << ", " <<  this->fInverse[4] << ", " << this->fInverse[5] << "]\n";
-			// std::cout << "Width and Height values: (" << this->fBitmap.width() << ", " << this->fBitmap.height() << ")\n";
-			// std::cout << "Scale values: (" << 1.0f/((float) this->fBitmap.width()) << ", " << 1.0f/((float) this->fBitmap.height()) << ")\n";
-        	this->fInverse.postScale(1.0f/((float) this->fBitmap.width()), 1.0f/((float) this->fBitmap.height()));
-   //      	std::cout << "Prescale this->fInverse\n";
-   //      	std::cout << "[" << this->fInverse[0] << ", " <<  this->fInverse[1] << ", " << this->fInverse[2] << "]\n";
-			// std::cout << "[" << this->fInverse[3] << ", " <<  this->fInverse[4] << ", " << this->fInverse[5] << "]\n";
-        	return true;
-        } else {
+        //fInverse maps device pixels straight to texels
+        if (!tmp.invert(&this->fInverse)) {
         	return false;
         }
-        return tmp.invert(&this->fInverse);
+        //shade_general works in unit space, where the bitmap spans [0, 1)
+        this->fUnitInverse = this->fInverse;
+        this->fUnitInverse.postScale(1.0f / this->fBitmap.width(), 1.0f / this->fBitmap.height());
+
+        //Trilinear picks the two mip levels around the texel footprint of one device pixel
+        this->fLevel = 0;
+        this->fLevelWeight = 0;
+        if (this->fQuality == FilterQuality::kTrilinear) {
+        	float footprint = std::max(std::hypot(this->fInverse[GMatrix::SX], this->fInverse[GMatrix::KY]),
+        							   std::hypot(this->fInverse[GMatrix::KX], this->fInverse[GMatrix::SY]));
+        	float lod = std::log2(footprint);
+        	if (lod > 0) {
+        		this->buildMipLevels();
+        		lod = std::min(lod, (float) (this->fLevels.size() - 1));
+        		this->fLevel = GFloorToInt(lod);
+        		if (this->fLevel + 1 < (int) this->fLevels.size()) {
+        			this->fLevelWeight = GRoundToInt((lod - this->fLevel) * 256);
+        		}
+        	}
+        }
+        if (this->fLevel > 0 || this->fLevelWeight > 0) {
+        	for (int i = 0; i < 2 && this->fLevel + i < (int) this->fLevels.size(); i++) {
+        		const GBitmap& level = this->fLevels[this->fLevel + i];
+        		this->fLevelInverse[i] = this->fInverse;
+        		this->fLevelInverse[i].postScale((float) level.width() / this->fBitmap.width(), (float) level.height() / this->fBitmap.height());
+        	}
+        } else {
+        	this->fLevelInverse[0] = this->fInverse;
+        }
+
+        //Pick the row proc now, so shadeRow never looks at the tile mode or the matrix type
+        bool scaleTranslate = this->fInverse[GMatrix::KX] == 0 && this->fInverse[GMatrix::KY] == 0;
+        switch (this->fTileMode) {
+        	case TileMode::kClamp:
+        		this->fShadeProc = this->chooseProc<TileMode::kClamp>(scaleTranslate);
+        		break;
+        	case TileMode::kRepeat:
+        		this->fShadeProc = this->chooseProc<TileMode::kRepeat>(scaleTranslate);
+        		break;
+        	case TileMode::kMirror:
+        		this->fShadeProc = this->chooseProc<TileMode::kMirror>(scaleTranslate);
+        		break;
+        }
+        return true;
     }
 
+	typedef void (*ShadeProc)(const MyShader&, int x, int y, int count, GPixel row[]);
+
+	template <TileMode mode> ShadeProc chooseProc(bool scaleTranslate) const {
+		if (this->fQuality == FilterQuality::kNearest) {
+			return scaleTranslate ? shade_scale_translate<mode> : shade_general<mode>;
+		}
+		return this->fLevelWeight > 0 ? shade_trilerp<mode> : shade_bilerp<mode>;
+	}
+
 	void shadeRow(int x, int y, int count, GPixel row[]) {
-		GPoint local = this->fInverse.mapXY(x + 0.5, y + 0.5);
-		GPixel sPixel;
-		GPixel* address;
-		// std::cout << "Starting local point: (" << local.fX << ", " << local.fY << ")\n";
+		this->fShadeProc(*this, x, y, count, row);
+	}
+
+	//Start over from the bitmap, the clone builds its own mip levels if it needs them. The first clone
+	//copies the pixels, since the caller's bitmap may be gone before the clone draws; its own clones share that copy.
+	std::unique_ptr<GShader> clone() const {
+		std::shared_ptr<const std::vector<GPixel>> pixels = this->fOwnedPixels;
+		GBitmap bitmap = this->fBitmap;
+		if (!pixels) {
+			int w = this->fBitmap.width();
+			int h = this->fBitmap.height();
+			std::vector<GPixel>* copy = new std::vector<GPixel>(w * h);
+			for (int y = 0; w > 0 && y < h; y++) {
+				memcpy(copy->data() + y * w, this->fBitmap.getAddr(0, y), w * sizeof(GPixel));
+			}
+			pixels.reset(copy);
+			bitmap.reset(w, h, w * sizeof(GPixel), copy->data(), this->fBitmap.isOpaque() ? GBitmap::kYes_IsOpaque : GBitmap::kNo_IsOpaque);
+		}
+		MyShader* shader = new MyShader(bitmap, this->fLocalInv, this->fTileMode, this->fQuality);
+		shader->fOwnedPixels = pixels;
+		return std::unique_ptr<GShader>(shader);
+	}
+
+	//The copied pixels are shared between clones, so each one counts them again
+	size_t approximateBytesUsed() const {
+		size_t bytes = sizeof(MyShader);
+		if (this->fOwnedPixels) {
+			bytes += this->fOwnedPixels->size() * sizeof(GPixel);
+		}
+		for (const std::vector<GPixel>& pixels : this->fLevelPixels) {
+			bytes += pixels.size() * sizeof(GPixel);
+		}
+		return bytes;
+	}
+
+	//Map a texel index that may be outside [0, n) back into it
+	template <TileMode mode> static int tile(int i, int n) {
+		switch (mode) {
+			case TileMode::kClamp:
+				return std::min(std::max(i, 0), n - 1);
+			case TileMode::kRepeat:
+				i %= n;
+				return i < 0 ? i + n : i;
+			case TileMode::kMirror:
+				i %= 2 * n;
+				if (i < 0) {
+					i += 2 * n;
+				}
+				return i < n ? i : 2 * n - 1 - i;
+		}
+		return 0;
+	}
+
+	//Map a unit space coordinate back into [0, 1], rounding the way shadeRow always has
+	template <TileMode mode> static float tile_unit(float t) {
+		switch (mode) {
+			case TileMode::kClamp:
+				return std::min(std::max(t, 0.0f), 0.99999f);
+			case TileMode::kRepeat:
+				return t - GFloorToInt(t);
+			case TileMode::kMirror:
+				t = t * 0.5f;
+				t = t - GFloorToInt(t);
+				if (t > 0.5f) {
+					t = 1 - t;
+				}
+				return t * 2;
+		}
+		return 0;
+	}
+
+	//Any matrix: map each pixel center back to the bitmap, stepping in unit space so rotated and skewed
+	//draws sample the same texels they always have. Only a coordinate that tiles to exactly 1 is pulled
+	//back to the last texel, where it used to read one past the end.
+	template <TileMode mode> static void shade_general(const MyShader& shader, int x, int y, int count, GPixel row[]) {
+		const GBitmap& bm = shader.fBitmap;
+		GPoint local = shader.fUnitInverse.mapXY(x + 0.5f, y + 0.5f);
+		float dx = shader.fUnitInverse[GMatrix::SX];
+		float dy = shader.fUnitInverse[GMatrix::KY];
 		for (int i = 0; i < count; i++) {
-			float fX = local.fX;
-			float fY = local.fY;
-			// std::cout << "Pretiling (fX, fY): (" << fX << ", " << fY << ")\n";
-			switch (this->fTileMode) {
-				case TileMode::kClamp:
-					fX = std::min(std::max(fX, 0.0f), 0.99999f);
-					fY = std::min(std::max(fY, 0.0f), 0.99999f);
-					// local.fX = std::min(std::max(local.fX, 0.0f), (float) this->fBitmap.width() - 1);
-					// local.fY = std::min(std::max(local.fY, 0.0f), (float) this->fBitmap.height() - 1);
-					break;
-	        	case TileMode::kRepeat:
-	        		fX = fX - GFloorToInt(fX);
-	        		fY = fY - GFloorToInt(fY);
-	        		break;
-	        	case TileMode::kMirror:
-	        		fX = fX * 0.5;
-	        		fX = fX - GFloorToInt(fX);
-	        		if (fX > 0.5) {
-	        			fX = 1 - fX;
-	        		}
-	        		fX = fX * 2;
-
-	        		fY = fY * 0.5;
-	        		fY = fY - GFloorToInt(fY);
-	        		if (fY > 0.5) {
-	        			fY = 1 - fY;
-	        		}
-	        		fY = fY * 2;
-	        		break;
+			int sX = std::min((int) (tile_unit<mode>(local.fX) * bm.width()), bm.width() - 1);
+			int sY = std::min((int) (tile_unit<mode>(local.fY) * bm.height()), bm.height() - 1);
+			row[i] = *bm.getAddr(sX, sY);
+			local.fX += dx;
+			local.fY += dy;
+		}
+	}
+
+	//No rotation or skew: the whole span reads one source row, stepping x in 16.16 fixed point
+	template <TileMode mode> static void shade_scale_translate(const MyShader& shader, int x, int y, int count, GPixel row[]) {
+		const GBitmap& bm = shader.fBitmap;
+		GPoint local = shader.fInverse.mapXY(x + 0.5f, y + 0.5f);
+		float dx = shader.fInverse[GMatrix::SX];
+		//Far outside the bitmap the fixed point would overflow, fall back to floats
+		float end = local.fX + dx * count;
+		if (!(std::abs(local.fX) < kMaxFixedTexel && std::abs(end) < kMaxFixedTexel)) {
+			shade_general<mode>(shader, x, y, count, row);
+			return;
+		}
+		const GPixel* src = bm.getAddr(0, tile<mode>(GFloorToInt(local.fY), bm.height()));
+		int width = bm.width();
+
+		int64_t fx = (int64_t) floor(local.fX * 65536.0);
+		int64_t fdx = (int64_t) floor(dx * 65536.0 + 0.5);
+		//Drawn at its own scale, so every texel in range is a straight copy
+		if (fdx == (1 << 16) && mode != TileMode::kMirror) {
+			int sX = (int) (fx >> 16);
+			int i = 0;
+			if (mode == TileMode::kClamp) {
+				for (; i < count && sX + i < 0; i++) {
+					row[i] = src[0];
+				}
+				int n = std::max(0, std::min(count, width - sX) - i);
+				memcpy(row + i, src + sX + i, n * sizeof(GPixel));
+				for (i += n; i < count; i++) {
+					row[i] = src[width - 1];
+				}
+			} else {
+				while (i < count) {
+					int start = tile<mode>(sX + i, width);
+					int n = std::min(count - i, width - start);
+					memcpy(row + i, src + start, n * sizeof(GPixel));
+					i += n;
+				}
+			}
+			return;
+		}
+		for (int i = 0; i < count; i++) {
+			row[i] = src[tile<mode>((int) (fx >> 16), width)];
+			fx += fdx;
+		}
+	}
+
+	//Blend the four texels around each pixel center, gathering a chunk of taps for the row kernel
+	template <TileMode mode> static void bilerp_span(const GBitmap& bm, const GMatrix& inverse, int x, int y, int count, GPixel row[]) {
+		static const BilerpRowProc proc = GetBilerpRowProc();
+		const int kChunk = 64;
+		GPixel tl[kChunk], tr[kChunk], bl[kChunk], br[kChunk];
+		uint16_t fx[kChunk], fy[kChunk];
+
+		//Texel centers sit at +0.5, so the taps are the ones around local - 0.5
+		GPoint local = inverse.mapXY(x + 0.5f, y + 0.5f);
+		local.fX -= 0.5f;
+		local.fY -= 0.5f;
+		float dx = inverse[GMatrix::SX];
+		float dy = inverse[GMatrix::KY];
+		for (int start = 0; start < count; start += kChunk) {
+			int n = std::min(kChunk, count - start);
+			for (int i = 0; i < n; i++) {
+				int x0 = GFloorToInt(local.fX);
+				int y0 = GFloorToInt(local.fY);
+				fx[i] = GRoundToInt((local.fX - x0) * 256);
+				fy[i] = GRoundToInt((local.fY - y0) * 256);
+				int c0 = tile<mode>(x0, bm.width());
+				int c1 = tile<mode>(x0 + 1, bm.width());
+				const GPixel* row0 = bm.getAddr(0, tile<mode>(y0, bm.height()));
+				const GPixel* row1 = bm.getAddr(0, tile<mode>(y0 + 1, bm.height()));
+				tl[i] = row0[c0];
+				tr[i] = row0[c1];
+				bl[i] = row1[c0];
+				br[i] = row1[c1];
+				local.fX += dx;
+				local.fY += dy;
 			}
-			// std::cout << "After tiling (fX, fY): " << fX << ", " << fY << ")\n";
-			fX *= this->fBitmap.width();
-			fY *= this->fBitmap.height();
-			int sX = (int) fX;
-			int sY = (int) fY;
-			// std::cout << "GetAddress (sX, sY): " << sX << ", " << sY << ")\n";
-			address = this->fBitmap.getAddr(sX, sY);
-			memcpy(&sPixel, address, sizeof(GPixel));
-			row[i] = sPixel;
-			local.fX += fInverse[GMatrix::SX];
-			local.fY += fInverse[GMatrix::KY];
+			proc(row + start, tl, tr, bl, br, fx, fy, n);
+		}
+	}
+
+	template <TileMode mode> static void shade_bilerp(const MyShader& shader, int x, int y, int count, GPixel row[]) {
+		bilerp_span<mode>(shader.fLevels.empty() ? shader.fBitmap : shader.fLevels[shader.fLevel], shader.fLevelInverse[0], x, y, count, row);
+	}
+
+	//Bilerp in the two nearest mip levels, then lerp between them
+	template <TileMode mode> static void shade_trilerp(const MyShader& shader, int x, int y, int count, GPixel row[]) {
+		const int kChunk = 64;
+		GPixel next[kChunk];
+		bilerp_span<mode>(shader.fLevels[shader.fLevel], shader.fLevelInverse[0], x, y, count, row);
+		for (int start = 0; start < count; start += kChunk) {
+			int n = std::min(kChunk, count - start);
+			bilerp_span<mode>(shader.fLevels[shader.fLevel + 1], shader.fLevelInverse[1], x + start, y, n, next);
+			for (int i = 0; i < n; i++) {
+				GPixel p = row[start + i];
+				unsigned t = shader.fLevelWeight;
+				row[start + i] = GPixel_PackARGB(lerp256(GPixel_GetA(p), GPixel_GetA(next[i]), t),
+												 lerp256(GPixel_GetR(p), GPixel_GetR(next[i]), t),
+												 lerp256(GPixel_GetG(p), GPixel_GetG(next[i]), t),
+												 lerp256(GPixel_GetB(p), GPixel_GetB(next[i]), t));
+			}
+		}
+	}
+
+	//Build every half-size level down to 1x1 the first time a draw minifies, each texel the average of 2x2 above it
+	void buildMipLevels() {
+		if (!this->fLevels.empty()) {
+			return;
+		}
+		this->fLevels.push_back(this->fBitmap);
+		while (this->fLevels.back().width() > 1 || this->fLevels.back().height() > 1) {
+			const GBitmap& src = this->fLevels.back();
+			int w = std::max(1, src.width() / 2);
+			int h = std::max(1, src.height() / 2);
+			this->fLevelPixels.push_back(std::vector<GPixel>(w * h));
+			GPixel* pixels = this->fLevelPixels.back().data();
+			for (int y = 0; y < h; y++) {
+				const GPixel* row0 = src.getAddr(0, std::min(2 * y, src.height() - 1));
+				const GPixel* row1 = src.getAddr(0, std::min(2 * y + 1, src.height() - 1));
+				for (int x = 0; x < w; x++) {
+					int x0 = std::min(2 * x, src.width() - 1);
+					int x1 = std::min(2 * x + 1, src.width() - 1);
+					GPixel p[4] = { row0[x0], row0[x1], row1[x0], row1[x1] };
+					int a = 2, r = 2, g = 2, b = 2;
+					for (int i = 0; i < 4; i++) {
+						a += GPixel_GetA(p[i]);
+						r += GPixel_GetR(p[i]);
+						g += GPixel_GetG(p[i]);
+						b += GPixel_GetB(p[i]);
+					}
+					pixels[x + y * w] = GPixel_PackARGB(a >> 2, r >> 2, g >> 2, b >> 2);
+				}
+			}
+			GBitmap level;
+			level.reset(w, h, w * sizeof(GPixel), pixels, this->fBitmap.isOpaque() ? GBitmap::kYes_IsOpaque : GBitmap::kNo_IsOpaque);
+			this->fLevels.push_back(level);
 		}
 	}
 
 private:
 	const GBitmap fBitmap;
+	//Set on clones, which keep their own copy of fBitmap's pixels
+	std::shared_ptr<const std::vector<GPixel>> fOwnedPixels;
 	GMatrix fLocalInv;
 	GMatrix fInverse;
+	GMatrix fUnitInverse;
 	GMatrix fLocalMatrix;
 	TileMode fTileMode;
+	FilterQuality fQuality;
+	ShadeProc fShadeProc;
+
+	//Mip pyramid for kTrilinear, level 0 is fBitmap. Built on the first minifying setContext.
+	std::vector<GBitmap> fLevels;
+	std::vector<std::vector<GPixel>> fLevelPixels;
+	//The level to sample (and the next one, for trilinear), mapping device pixels to that level's texels
+	int fLevel;
+	int fLevelWeight;
+	GMatrix fLevelInverse[2];
+
+	static constexpr float kMaxFixedTexel = 1 << 30;
 };
 
-std::unique_ptr<GShader> GCreateBitmapShader(const GBitmap& bitmap, const GMatrix& localInv,  GShader::TileMode tileMode) {
+std::unique_ptr<GShader> GCreateBitmapShader(const GBitmap& bitmap, const GMatrix& localInv,  GShader::TileMode tileMode, GShader::FilterQuality quality) {
 	if (!bitmap.pixels()) {
 		return nullptr;
 	}
@@ -122,5 +360,5 @@ std::unique_ptr<GShader> GCreateBitmapShader(const GBitmap& bitmap, const GMatri
 	// if (!localInv.invert(testMatrix)) {
 	// 	return nullptr;
 	// }
-	return std::unique_ptr<GShader>(new MyShader(bitmap, localInv, tileMode));
+	return std::unique_ptr<GShader>(new MyShader(bitmap, localInv, tileMode, quality));
 }
\ No newline at end of file
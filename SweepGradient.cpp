@@ -0,0 +1,87 @@
+#include "GColor.h"
+#include "GShader.h"
+#include "GMatrix.h"
+#include "GPoint.h"
+#include "GMath.h"
+#include "GPixel.h"
+#include "Gradient.h"
+#include <cmath>
+#include <memory>
+
+class MySweepGradient: public GradientShader {
+public:
+
+	MySweepGradient(GPoint center, float startRadians, float endRadians, const GColor colors[], int count, GShader::TileMode tileMode) : GradientShader(colors, count, tileMode), fCenter(center), fStart(startRadians), fEnd(endRadians), fInvSweep(1.0f / (endRadians - startRadians)) {
+		this->fLocalMatrix.setTranslate(center.fX, center.fY);
+	}
+
+	bool setContext(const GMatrix& ctm) {
+		GMatrix tmp;
+		tmp.setConcat(ctm, this->fLocalMatrix);
+		if (!tmp.invert(&this->fInverse)) {
+			return false;
+		}
+		//With one color only fLUT[0] is filled, so every pixel is that color
+		if (this->fColors.size() == 1) {
+			this->fShadeProc = shade_solid;
+			return true;
+		}
+		switch (this->fTileMode) {
+			case TileMode::kClamp:
+				this->fShadeProc = shade_sweep<TileMode::kClamp>;
+				break;
+			case TileMode::kRepeat:
+				this->fShadeProc = shade_sweep<TileMode::kRepeat>;
+				break;
+			case TileMode::kMirror:
+				this->fShadeProc = shade_sweep<TileMode::kMirror>;
+				break;
+		}
+		return true;
+	}
+
+	void shadeRow(int x, int y, int count, GPixel row[]) {
+		this->fShadeProc(*this, x, y, count, row);
+	}
+
+	std::unique_ptr<GShader> clone() const {
+		return std::unique_ptr<GShader>(new MySweepGradient(this->fCenter, this->fStart, this->fEnd, this->fColors.data(), this->fColors.size(), this->fTileMode));
+	}
+
+	//t is the angle from the start angle (going the same way as setRotate), in units of the sweep
+	template <TileMode mode> static void shade_sweep(const MySweepGradient& shader, int x, int y, int count, GPixel row[]) {
+		const float kTwoPi = 2 * M_PI;
+		GPoint local = shader.fInverse.mapXY(x + 0.5f, y + 0.5f);
+		float dx = shader.fInverse[GMatrix::SX];
+		float dy = shader.fInverse[GMatrix::KY];
+		for (int i = 0; i < count; i++) {
+			float angle = atan2f(local.fY, local.fX) - shader.fStart;
+			angle -= kTwoPi * GFloorToInt(angle / kTwoPi);
+			row[i] = shader.lookup<mode>(angle * shader.fInvSweep);
+			local.fX += dx;
+			local.fY += dy;
+		}
+	}
+
+	static void shade_solid(const MySweepGradient& shader, int x, int y, int count, GPixel row[]) {
+		for (int i = 0; i < count; i++) {
+			row[i] = shader.fLUT[0];
+		}
+	}
+
+private:
+	GPoint fCenter;
+	float fStart;
+	float fEnd;
+	float fInvSweep;
+	GMatrix fInverse;
+	GMatrix fLocalMatrix;
+	void (*fShadeProc)(const MySweepGradient&, int x, int y, int count, GPixel row[]);
+};
+
+std::unique_ptr<GShader> GCreateSweepGradient(GPoint center, float startRadians, float endRadians, const GColor colors[], int count, GShader::TileMode tileMode) {
+	if (count < 1 || !(endRadians > startRadians)) {
+		return nullptr;
+	}
+	return std::unique_ptr<GShader>(new MySweepGradient(center, startRadians, endRadians, colors, count, tileMode));
+}
@@ -0,0 +1,468 @@
+#include "GCanvas.h"
+#include "GBitmap.h"
+#include "GFilter.h"
+#include "GMatrix.h"
+#include "GPaint.h"
+#include "GPath.h"
+#include "GPoint.h"
+#include "GRect.h"
+#include "GShader.h"
+#include "EmptyCanvas.h"
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <stack>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+//Rows per band. Small enough that even a few hundred rows spread over the threads.
+static const int kBandHeight = 64;
+
+//Runs the tasks [0, count) of each run() on its threads, and on the calling thread
+class ThreadPool {
+public:
+	ThreadPool(int threadCount) {
+		for (int i = 1; i < threadCount; i++) {
+			fThreads.emplace_back([this]() { this->work(); });
+		}
+	}
+
+	~ThreadPool() {
+		{
+			std::lock_guard<std::mutex> lock(fMutex);
+			fQuit = true;
+		}
+		fWake.notify_all();
+		for (std::thread& thread : fThreads) {
+			thread.join();
+		}
+	}
+
+	void run(int count, const std::function<void(int)>& task) {
+		{
+			std::unique_lock<std::mutex> lock(fMutex);
+			fTask = &task;
+			fCount = count;
+			fNext = 0;
+			fPending = count;
+			fGeneration++;
+		}
+		fWake.notify_all();
+		this->drain(task, count);
+
+		//Nobody may still be inside this run once it returns, or they could take the next run's tasks
+		std::unique_lock<std::mutex> lock(fMutex);
+		fDone.wait(lock, [this]() { return fPending == 0 && fBusy == 0; });
+	}
+
+private:
+	void work() {
+		int seen = 0;
+		while (true) {
+			const std::function<void(int)>* task;
+			int count;
+			{
+				std::unique_lock<std::mutex> lock(fMutex);
+				fWake.wait(lock, [this, seen]() { return fQuit || fGeneration != seen; });
+				if (fQuit) {
+					return;
+				}
+				seen = fGeneration;
+				//Woken too late for this run, which has finished and whose task may be gone, so wait for the next
+				if (fPending == 0) {
+					continue;
+				}
+				task = fTask;
+				count = fCount;
+				fBusy++;
+			}
+			this->drain(*task, count);
+			{
+				std::lock_guard<std::mutex> lock(fMutex);
+				fBusy--;
+			}
+			fDone.notify_all();
+		}
+	}
+
+	void drain(const std::function<void(int)>& task, int count) {
+		int i;
+		while ((i = fNext++) < count) {
+			task(i);
+			if (--fPending == 0) {
+				std::lock_guard<std::mutex> lock(fMutex);
+				fDone.notify_all();
+			}
+		}
+	}
+
+	std::vector<std::thread> fThreads;
+	std::mutex fMutex;
+	std::condition_variable fWake;
+	std::condition_variable fDone;
+	const std::function<void(int)>* fTask = nullptr;
+	int fCount = 0;
+	int fGeneration = 0;
+	int fBusy = 0;
+	bool fQuit = false;
+	std::atomic<int> fNext{0};
+	std::atomic<int> fPending{0};
+};
+
+struct Command {
+public:
+	enum Type {
+		kSave,
+		kSaveLayer,
+		kRestore,
+		kConcat,
+		kClipRect,
+		kClipPath,
+		kDrawPaint,
+		kDrawRect,
+		kDrawPolygon,
+		kDrawPath,
+	};
+
+	Type fType;
+	//The draw's paint, the saveLayer's paint, or for a restore the paint of the layer it closes.
+	//Its shader and filter are the canvas's own clones, unless fBorrowed.
+	GPaint fPaint;
+	bool fBorrowed;
+	GMatrix fMatrix;
+	//The rect to draw or clip to, or the saveLayer bounds if fHasRect
+	GRect fRect;
+	bool fHasRect;
+	//kDrawPolygon: fCount points starting at fIndex in fPoints. kDrawPath, kClipPath: fPaths[fIndex].
+	int fIndex;
+	int fCount;
+	//Device rows a draw can touch, rounded out
+	int fTop;
+	int fBottom;
+};
+
+//One band of the bitmap, and everything its thread keeps between flushes
+struct Band {
+public:
+	int fTop;
+	int fBottom;
+	std::unique_ptr<GCanvas> fCanvas;
+	//This band's copies of the shaders and filters, by the pointer the draws were recorded with
+	std::unordered_map<const void*, void*> fClones;
+	//The clones are kept while a layer may still be holding one of their paints
+	std::vector<std::unique_ptr<GShader>> fShaderClones;
+	std::vector<std::unique_ptr<GFilter>> fFilterClones;
+};
+
+class TiledCanvas: public GCanvas {
+public:
+
+	TiledCanvas(const GBitmap& device, int threadCount) : fDevice(device), fPool(threadCount) {
+		for (int top = 0; top < device.height(); top += kBandHeight) {
+			Band band;
+			band.fTop = top;
+			band.fBottom = std::min(device.height(), top + kBandHeight);
+			band.fCanvas = CreateBandCanvas(device, band.fTop, band.fBottom);
+			fBands.push_back(std::move(band));
+		}
+	}
+
+	~TiledCanvas() {
+		this->flush();
+	}
+
+	void save() override {
+		this->record(Command::kSave, GPaint());
+		fSaveStack.push(SaveRecord{ fCTM, false, GPaint(), false });
+	}
+
+	void restore() override {
+		if (fSaveStack.empty()) {
+			//Error
+			return;
+		}
+		SaveRecord record = fSaveStack.top();
+		fSaveStack.pop();
+		fCTM = record.fCTM;
+		Command& command = this->record(Command::kRestore, GPaint());
+		command.fPaint = record.fLayerPaint;
+		command.fBorrowed = record.fBorrowed;
+		//The layer's filter is only borrowed until this restore
+		this->flushIfBorrowed(command);
+	}
+
+	void concat(const GMatrix& matrix) override {
+		this->record(Command::kConcat, GPaint()).fMatrix = matrix;
+		fCTM.preConcat(matrix);
+	}
+
+	//Clips change what later draws touch in every band, so like saves they are never culled
+	void clipRect(const GRect& rect) override {
+		this->record(Command::kClipRect, GPaint()).fRect = rect;
+	}
+
+	void clipPath(const GPath& path) override {
+		this->record(Command::kClipPath, GPaint()).fIndex = fPaths.size();
+		fPaths.push_back(path);
+	}
+
+	void drawPaint(const GPaint& paint) override {
+		Command& command = this->record(Command::kDrawPaint, paint);
+		command.fTop = 0;
+		command.fBottom = fDevice.height();
+		this->flushIfBorrowed(command);
+	}
+
+	void drawRect(const GRect& rect, const GPaint& paint) override {
+		GPoint points[4] = {
+			GPoint::Make(rect.fLeft, rect.fTop), GPoint::Make(rect.fRight, rect.fTop),
+			GPoint::Make(rect.fRight, rect.fBottom), GPoint::Make(rect.fLeft, rect.fBottom),
+		};
+		Command& command = this->record(Command::kDrawRect, paint);
+		command.fRect = rect;
+		this->setRows(&command, points, 4);
+		this->flushIfBorrowed(command);
+	}
+
+	void drawConvexPolygon(const GPoint points[], int count, const GPaint& paint) override {
+		Command& command = this->record(Command::kDrawPolygon, paint);
+		command.fIndex = fPoints.size();
+		command.fCount = count;
+		fPoints.insert(fPoints.end(), points, points + count);
+		this->setRows(&command, points, count);
+		this->flushIfBorrowed(command);
+	}
+
+	void drawPath(const GPath& path, const GPaint& paint) override {
+		GRect r = path.bounds();
+		GPoint points[4] = {
+			GPoint::Make(r.fLeft, r.fTop), GPoint::Make(r.fRight, r.fTop),
+			GPoint::Make(r.fRight, r.fBottom), GPoint::Make(r.fLeft, r.fBottom),
+		};
+		Command& command = this->record(Command::kDrawPath, paint);
+		command.fIndex = fPaths.size();
+		fPaths.push_back(path);
+		this->setRows(&command, points, 4);
+		this->flushIfBorrowed(command);
+	}
+
+	void flush() override {
+		if (fCommands.empty()) {
+			return;
+		}
+		fPool.run(fBands.size(), [this](int i) { this->replay(&fBands[i]); });
+		fCommands.clear();
+		fPoints.clear();
+		fPaths.clear();
+		fShaderClones.clear();
+		fFilterClones.clear();
+
+		//With no layer open, nothing still points at the clones
+		bool layerOpen = false;
+		for (std::stack<SaveRecord> records = fSaveStack; !records.empty(); records.pop()) {
+			layerOpen |= records.top().fIsLayer;
+		}
+		if (!layerOpen) {
+			fShaders.clear();
+			fFilters.clear();
+		}
+		for (Band& band : fBands) {
+			band.fClones.clear();
+			if (!layerOpen) {
+				band.fShaderClones.clear();
+				band.fFilterClones.clear();
+			}
+		}
+	}
+
+protected:
+	void onSaveLayer(const GRect* bounds, const GPaint& paint) override {
+		Command& command = this->record(Command::kSaveLayer, paint);
+		if (bounds) {
+			command.fRect = *bounds;
+			command.fHasRect = true;
+		}
+		fSaveStack.push(SaveRecord{ fCTM, true, command.fPaint, command.fBorrowed });
+	}
+
+private:
+	struct SaveRecord {
+		GMatrix fCTM;
+		bool fIsLayer;
+		GPaint fLayerPaint;
+		bool fBorrowed;
+	};
+
+	Command& record(Command::Type type, const GPaint& paint) {
+		fCommands.push_back(Command());
+		Command& command = fCommands.back();
+		command.fType = type;
+		command.fPaint = paint;
+		command.fBorrowed = false;
+		command.fHasRect = false;
+
+		//Keep our own copies, the caller's shader and filter may be gone by the time this is drawn. One copy
+		//per flush is enough, since commands only use them through the bands' own clones.
+		if (GShader* shader = paint.getShader()) {
+			auto it = fShaderClones.find(shader->uniqueID());
+			if (it == fShaderClones.end()) {
+				std::unique_ptr<GShader> clone = shader->clone();
+				it = fShaderClones.emplace(shader->uniqueID(), clone.get()).first;
+				fShaders.push_back(std::move(clone));
+			}
+			if (it->second) {
+				command.fPaint.setShader(it->second);
+			} else {
+				command.fBorrowed = true;
+			}
+		}
+		if (GFilter* filter = paint.getFilter()) {
+			auto it = fFilterClones.find(filter->uniqueID());
+			if (it == fFilterClones.end()) {
+				std::unique_ptr<GFilter> clone = filter->clone();
+				it = fFilterClones.emplace(filter->uniqueID(), clone.get()).first;
+				fFilters.push_back(std::move(clone));
+			}
+			if (it->second) {
+				command.fPaint.setFilter(it->second);
+			} else {
+				command.fBorrowed = true;
+			}
+		}
+		return command;
+	}
+
+	//A shader or filter we could not copy is only known to be alive during the call that passed it
+	void flushIfBorrowed(const Command& command) {
+		if (command.fBorrowed) {
+			this->flush();
+		}
+	}
+
+	//The rows the points cover once mapped to the device
+	void setRows(Command* command, const GPoint points[], int count) {
+		float top = fDevice.height();
+		float bottom = 0;
+		for (int i = 0; i < count; i++) {
+			GPoint p = fCTM.mapPt(points[i]);
+			top = std::min(top, p.fY);
+			bottom = std::max(bottom, p.fY);
+		}
+		//Clamped first, so far-off geometry cannot overflow the conversion
+		command->fTop = GFloorToInt(std::max(top, -1.0f));
+		command->fBottom = GCeilToInt(std::min(bottom, (float) fDevice.height())) + 1;
+	}
+
+	//Swap the paint's shader and filter for this band's clones. Returns false if one cannot be
+	//cloned, and so has to be used under fSharedMutex.
+	bool bandPaint(Band* band, const GPaint& paint, GPaint* bandPaint) {
+		*bandPaint = paint;
+		bool cloned = true;
+		if (GShader* shader = paint.getShader()) {
+			auto it = band->fClones.find(shader);
+			if (it == band->fClones.end()) {
+				std::unique_ptr<GShader> clone = shader->clone();
+				it = band->fClones.emplace(shader, clone.get()).first;
+				band->fShaderClones.push_back(std::move(clone));
+			}
+			if (it->second) {
+				bandPaint->setShader((GShader*) it->second);
+			} else {
+				cloned = false;
+			}
+		}
+		if (GFilter* filter = paint.getFilter()) {
+			auto it = band->fClones.find(filter);
+			if (it == band->fClones.end()) {
+				std::unique_ptr<GFilter> clone = filter->clone();
+				it = band->fClones.emplace(filter, clone.get()).first;
+				band->fFilterClones.push_back(std::move(clone));
+			}
+			if (it->second) {
+				bandPaint->setFilter((GFilter*) it->second);
+			} else {
+				cloned = false;
+			}
+		}
+		return cloned;
+	}
+
+	void replay(Band* band) {
+		GCanvas* canvas = band->fCanvas.get();
+		for (const Command& command : fCommands) {
+			bool isDraw = command.fType >= Command::kDrawPaint;
+			if (isDraw && (command.fBottom <= band->fTop || command.fTop >= band->fBottom)) {
+				continue;
+			}
+
+			GPaint paint;
+			std::unique_lock<std::mutex> lock(fSharedMutex, std::defer_lock);
+			if (!this->bandPaint(band, command.fPaint, &paint)) {
+				lock.lock();
+			}
+			switch (command.fType) {
+				case Command::kSave:
+					canvas->save();
+					break;
+				case Command::kSaveLayer:
+					canvas->saveLayer(command.fHasRect ? &command.fRect : nullptr, paint);
+					break;
+				case Command::kRestore:
+					canvas->restore();
+					break;
+				case Command::kConcat:
+					canvas->concat(command.fMatrix);
+					break;
+				case Command::kClipRect:
+					canvas->clipRect(command.fRect);
+					break;
+				case Command::kClipPath:
+					canvas->clipPath(fPaths[command.fIndex]);
+					break;
+				case Command::kDrawPaint:
+					canvas->drawPaint(paint);
+					break;
+				case Command::kDrawRect:
+					canvas->drawRect(command.fRect, paint);
+					break;
+				case Command::kDrawPolygon:
+					canvas->drawConvexPolygon(&fPoints[command.fIndex], command.fCount, paint);
+					break;
+				case Command::kDrawPath:
+					canvas->drawPath(fPaths[command.fIndex], paint);
+					break;
+			}
+		}
+	}
+
+	GBitmap fDevice;
+	GMatrix fCTM;
+	std::stack<SaveRecord> fSaveStack;
+	std::vector<Command> fCommands;
+	std::vector<GPoint> fPoints;
+	std::vector<GPath> fPaths;
+	//Clones of the recorded shaders and filters, kept while a command or an open layer uses them
+	std::vector<std::unique_ptr<GShader>> fShaders;
+	std::vector<std::unique_ptr<GFilter>> fFilters;
+	//This flush's clone of each recorded shader and filter (null if it cannot be cloned), by uniqueID()
+	std::unordered_map<uint32_t, GShader*> fShaderClones;
+	std::unordered_map<uint32_t, GFilter*> fFilterClones;
+	std::vector<Band> fBands;
+	//Held by a band while it uses a shader or filter that could not be cloned
+	std::mutex fSharedMutex;
+	ThreadPool fPool;
+};
+
+std::unique_ptr<GCanvas> GCreateTiledCanvas(const GBitmap& device, int threadCount) {
+	if (!device.pixels()) {
+		return nullptr;
+	}
+	if (threadCount <= 0) {
+		threadCount = std::max(1u, std::thread::hardware_concurrency());
+	}
+	return std::unique_ptr<GCanvas>(new TiledCanvas(device, threadCount));
+}
@@ -16,6 +16,8 @@ public:
     void save() override { if (fProxy) fProxy->save(); }
     void restore() override { if (fProxy) fProxy->restore(); }
     void concat(const GMatrix& m) override { if (fProxy) fProxy->concat(m); }
+    void clipRect(const GRect& r) override { if (fProxy) fProxy->clipRect(r); }
+    void clipPath(const GPath& p) override { if (fProxy) fProxy->clipPath(p); }
 
     void drawPaint(const GPaint& p) override {
         if (this->allowDraw()) {
@@ -41,6 +43,8 @@ public:
         }
     }
 
+    void flush() override { if (fProxy) fProxy->flush(); }
+
 protected:
     void onSaveLayer(const GRect* bounds, const GPaint& paint) override {
         if (fProxy) { fProxy->saveLayer(bounds, paint); }
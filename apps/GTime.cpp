@@ -7,6 +7,7 @@
 #include "GTime.h"
 
 #include <sys/time.h>
+#include <time.h>
 
 GMSec GTime::GetMSec() {
     struct timeval tv;
@@ -18,3 +19,12 @@ GMSec GTime::GetMSec() {
     }
 }
 
+GNSec GTime::GetNSec() {
+    struct timespec ts;
+
+    if (clock_gettime(CLOCK_MONOTONIC, &ts)) {
+        return 0;
+    } else {
+        return (GNSec)ts.tv_sec * 1000000000 + ts.tv_nsec;
+    }
+}
@@ -6,8 +6,12 @@
 #include "GCanvas.h"
 #include "GBitmap.h"
 #include "GTime.h"
+#include <algorithm>
+#include <cmath>
+#include <map>
 #include <memory>
 #include <string>
+#include <vector>
 #include <sys/stat.h>
 #include <unistd.h>
 
@@ -77,24 +81,219 @@ static void setup_bitmap(GBitmap* bitmap, int w, int h) {
     bitmap->reset(w, h, rb, (GPixel*)calloc(h, rb), GBitmap::kNo_IsOpaque);
 }
 
-static double handle_proc(GBenchmark* bench, const char path[], GBitmap* bitmap, bool forever) {
-    GISize size = bench->size();
+struct BenchOptions {
+    int     fSamples = 10;          // timed samples per bench
+    double  fSampleMS = 10;         // each sample runs enough draws to take about this long
+    bool    fForever = false;       // just draw, for running under a profiler
+    int     fSweepMax = 0;          // if set, run each bench at 64x64, 128x128, ... up to this
+};
+
+// The first size of the sweep; each next one doubles both sides
+static const int kSweepMin = 64;
+
+// Per-draw times in milliseconds, over the samples
+struct BenchStats {
+    double  fMin;
+    double  fMedian;
+    double  fP90;
+    double  fStddev;
+    int     fSamples;
+    int     fLoops;                 // draws per sample
+    double  fMPixelsPerSec;         // at the median, or 0 if the bench does not count pixels
+};
+
+static double ns_to_ms(GNSec ns) {
+    return ns * 1e-6;
+}
+
+static GNSec time_loops(GBenchmark* bench, GCanvas* canvas, int loops) {
+    GNSec start = GTime::GetNSec();
+    for (int i = 0; i < loops; ++i) {
+        bench->draw(canvas);
+    }
+    return GTime::GetNSec() - start;
+}
+
+/*
+ *  Pick the draws per sample: keep doubling until a batch takes the target time. The batches
+ *  along the way double as warmup (caches, branch predictors, lazily grown canvas storage), and
+ *  one more batch at the final count finishes it.
+ */
+static int calibrate_loops(GBenchmark* bench, GCanvas* canvas, double targetMS) {
+    int loops = 1;
+    while (ns_to_ms(time_loops(bench, canvas, loops)) < targetMS && loops < (1 << 24)) {
+        loops *= 2;
+    }
+    time_loops(bench, canvas, loops);
+    return loops;
+}
+
+static BenchStats compute_stats(std::vector<double> times, int loops) {
+    std::sort(times.begin(), times.end());
+    int n = (int)times.size();
+
+    double mean = 0;
+    for (double t : times) {
+        mean += t;
+    }
+    mean /= n;
+    double var = 0;
+    for (double t : times) {
+        var += (t - mean) * (t - mean);
+    }
+
+    BenchStats stats;
+    stats.fMin = times[0];
+    stats.fMedian = (n & 1) ? times[n / 2] : (times[n / 2 - 1] + times[n / 2]) * 0.5;
+    stats.fP90 = times[std::max(0, (int)std::ceil(0.9 * n) - 1)];   // nearest rank
+    stats.fStddev = n > 1 ? std::sqrt(var / (n - 1)) : 0;
+    stats.fSamples = n;
+    stats.fLoops = loops;
+    stats.fMPixelsPerSec = 0;
+    return stats;
+}
+
+/*
+ *  Run the bench on a canvas of the given size. A bench that cannot resize() itself draws as is,
+ *  under a CTM that scales its own size() up (or down) to fill the canvas, so its pixel count
+ *  scales by the same area.
+ */
+static bool handle_proc(GBenchmark* bench, GBitmap* bitmap, GISize size,
+                        const BenchOptions& options, BenchStats* stats) {
+    GISize natural = bench->size();
+    bool fit = (size.fWidth != natural.fWidth || size.fHeight != natural.fHeight) &&
+               !bench->resize(size);
     setup_bitmap(bitmap, size.fWidth, size.fHeight);
 
     auto canvas = GCreateCanvas(*bitmap);
-    if (!canvas) {
+    if (!canvas || !bitmap->pixels()) {
         fprintf(stderr, "failed to create canvas for [%d %d] %s\n",
                 size.fWidth, size.fHeight, bench->name());
-        return 0;
+        return false;
+    }
+    double sx = 1.0 * size.fWidth / natural.fWidth;
+    double sy = 1.0 * size.fHeight / natural.fHeight;
+    if (fit) {
+        canvas->scale(sx, sy);
+    }
+
+    if (options.fForever) {
+        for (;;) {
+            bench->draw(canvas.get());
+        }
+    }
+
+    int loops = calibrate_loops(bench, canvas.get(), options.fSampleMS);
+    std::vector<double> times(options.fSamples);
+    for (double& t : times) {
+        t = ns_to_ms(time_loops(bench, canvas.get(), loops)) / loops;
+    }
+    *stats = compute_stats(times, loops);
+
+    double pixels = bench->pixelsPerDraw() * (fit ? sx * sy : 1);
+    // A sweep wants a throughput for every bench, so those that count nothing count the canvas
+    if (pixels <= 0 && options.fSweepMax) {
+        pixels = (double)size.fWidth * size.fHeight;
+    }
+    if (pixels > 0 && stats->fMedian > 0) {
+        stats->fMPixelsPerSec = pixels / (stats->fMedian * 1000);
+    }
+    return true;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////
+
+struct BenchResult {
+    std::string fName;
+    BenchStats  fStats;
+};
+
+/*
+ *  Both formats hold one benchmark per line, so either can be read back as a baseline:
+ *
+ *  json:  { "unit": "ms", "benchmarks": [
+ *           {"name": "rects_blend", "min": 2.5, "median": 2.6, "p90": 2.7, "stddev": 0.03, "samples": 10, "loops": 8, "mpps": 0},
+ *           ...
+ *         ] }
+ *  csv:   name,min,median,p90,stddev,samples,loops,mpps     (a header line, then one row per benchmark)
+ *
+ *  mpps is megapixels per second at the median (0 if the bench does not count pixels). It is
+ *  derived from the median, so baselines do not read it.
+ */
+// Names are read into a char[256], so at most 255 characters of one are taken
+static const char gJSONRowFormat[] =
+    "{\"name\": \"%255[^\"]\", \"min\": %lf, \"median\": %lf, \"p90\": %lf, \"stddev\": %lf, "
+    "\"samples\": %d, \"loops\": %d";
+static const char gCSVRowFormat[] = "%255[^,],%lf,%lf,%lf,%lf,%d,%d";
+static const char gCSVHeader[] = "name,min,median,p90,stddev,samples,loops,mpps";
+
+static bool write_results(const char path[], const std::vector<BenchResult>& results, bool json) {
+    FILE* f = fopen(path, "w");
+    if (!f) {
+        fprintf(stderr, "can't write %s\n", path);
+        return false;
+    }
+    fprintf(f, "%s\n", json ? "{ \"unit\": \"ms\", \"benchmarks\": [" : gCSVHeader);
+    for (size_t i = 0; i < results.size(); ++i) {
+        const BenchStats& st = results[i].fStats;
+        if (json) {
+            fprintf(f, "{\"name\": \"%s\", \"min\": %.9g, \"median\": %.9g, \"p90\": %.9g, "
+                    "\"stddev\": %.9g, \"samples\": %d, \"loops\": %d, \"mpps\": %.6g}%s\n",
+                    results[i].fName.c_str(), st.fMin, st.fMedian, st.fP90, st.fStddev,
+                    st.fSamples, st.fLoops, st.fMPixelsPerSec, i + 1 < results.size() ? "," : "");
+        } else {
+            fprintf(f, "%s,%.9g,%.9g,%.9g,%.9g,%d,%d,%.6g\n",
+                    results[i].fName.c_str(), st.fMin, st.fMedian, st.fP90, st.fStddev,
+                    st.fSamples, st.fLoops, st.fMPixelsPerSec);
+        }
+    }
+    if (json) {
+        fprintf(f, "] }\n");
     }
+    return fclose(f) == 0;
+}
 
-    const int N = 100;
-    GMSec now = GTime::GetMSec();
-    for (int i = 0; i < N || forever; ++i) {
-        bench->draw(canvas.get());
+// Read a file written with --json or --csv. Lines that are not a benchmark are skipped.
+static bool read_baseline(const char path[], std::map<std::string, BenchStats>* baseline) {
+    FILE* f = fopen(path, "r");
+    if (!f) {
+        fprintf(stderr, "can't read baseline %s\n", path);
+        return false;
     }
-    GMSec dur = GTime::GetMSec() - now;
-    return dur * 1.0 / N;
+    char line[1024];
+    char name[256];
+    while (fgets(line, sizeof(line), f)) {
+        const char* p = line + strspn(line, " \t");
+        BenchStats st;
+        const char* format = *p == '{' ? gJSONRowFormat : gCSVRowFormat;
+        if (sscanf(p, format, name, &st.fMin, &st.fMedian, &st.fP90, &st.fStddev,
+                   &st.fSamples, &st.fLoops) == 7 && st.fMedian > 0) {
+            (*baseline)[name] = st;
+        }
+    }
+    fclose(f);
+    return true;
+}
+
+/*
+ *  How much slower (as a fraction) a median may get before it counts as a regression: at least
+ *  minDelta, and more for noisy benches -- three standard errors of the difference of the two
+ *  medians, so run-to-run jitter alone rarely trips it.
+ */
+static double regression_threshold(const BenchStats& now, const BenchStats& base, double minDelta) {
+    double seNow = now.fStddev / std::sqrt((double)now.fSamples);
+    double seBase = base.fStddev / std::sqrt((double)base.fSamples);
+    return std::max(minDelta, 3 * std::sqrt(seNow * seNow + seBase * seBase) / base.fMedian);
+}
+
+/*
+ *  Interference from the rest of the machine only ever adds time, so it can drag a whole run's
+ *  median up while the fastest sample holds steady. A real slowdown moves both, so both must
+ *  move for a regression.
+ */
+static bool is_regression(const BenchStats& now, const BenchStats& base, double threshold,
+                          double minDelta) {
+    return now.fMedian > base.fMedian * (1 + threshold) && now.fMin > base.fMin * (1 + minDelta);
 }
 
 static bool is_arg(const char arg[], const char name[]) {
@@ -113,11 +312,15 @@ static bool is_arg(const char arg[], const char name[]) {
 
 int main(int argc, char** argv) {
     bool verbose = false;
-    bool forever = false;
+    BenchOptions options;
     const char* match = NULL;
     const char* report = NULL;
     const char* author = NULL;
     FILE* reportFile = NULL;
+    const char* jsonPath = NULL;
+    const char* csvPath = NULL;
+    const char* baselinePath = NULL;
+    double minDelta = 0.05;
 
     for (int i = 1; i < argc; ++i) {
         if (is_arg(argv[i], "report") && i+2 < argc) {
@@ -133,10 +336,33 @@ int main(int argc, char** argv) {
         } else if (is_arg(argv[i], "match") && i+1 < argc) {
             match = argv[++i];
         } else if (is_arg(argv[i], "forever")) {
-            forever = true;
+            options.fForever = true;
+        } else if (is_arg(argv[i], "samples") && i+1 < argc) {
+            options.fSamples = std::max(1, atoi(argv[++i]));
+        } else if (is_arg(argv[i], "time") && i+1 < argc) {
+            options.fSampleMS = std::max(0.0, atof(argv[++i]));
+        } else if (is_arg(argv[i], "json") && i+1 < argc) {
+            jsonPath = argv[++i];
+        } else if (is_arg(argv[i], "csv") && i+1 < argc) {
+            csvPath = argv[++i];
+        } else if (is_arg(argv[i], "baseline") && i+1 < argc) {
+            baselinePath = argv[++i];
+        } else if (is_arg(argv[i], "delta") && i+1 < argc) {
+            minDelta = std::max(0.0, atof(argv[++i]) / 100);
+        } else if (!strcmp(argv[i], "--sweep")) {
+            options.fSweepMax = 8192;
+        } else if (!strcmp(argv[i], "--sweep-max") && i+1 < argc) {
+            options.fSweepMax = std::max(kSweepMin, atoi(argv[++i]));
         }
     }
 
+    std::map<std::string, BenchStats> baseline;
+    if (baselinePath && !read_baseline(baselinePath, &baseline)) {
+        return -1;
+    }
+    std::vector<BenchResult> results;
+    int regressions = 0;
+
     for (int i = 0; gBenchFactories[i]; ++i) {
         std::unique_ptr<GBenchmark> bench(gBenchFactories[i]());
         const char* name = bench->name();
@@ -148,11 +374,62 @@ int main(int argc, char** argv) {
             printf("image: %s\n", name);
         }
         
-        GBitmap testBM;
-        double dur = handle_proc(bench.get(), name, &testBM, forever);
-        printf("bench: %s %g\n", name, dur);
+        // One run at the bench's own size, or one per size of the sweep, named name@size
+        std::vector<GISize> sizes;
+        if (options.fSweepMax) {
+            for (int n = kSweepMin; n <= options.fSweepMax; n *= 2) {
+                sizes.push_back({ n, n });
+            }
+        } else {
+            sizes.push_back(bench->size());
+        }
+
+        for (GISize size : sizes) {
+            std::string runName = name;
+            if (options.fSweepMax) {
+                runName += "@" + std::to_string(size.fWidth);
+            }
+            GBitmap testBM;
+            BenchStats stats;
+            if (handle_proc(bench.get(), &testBM, size, options, &stats)) {
+                // Times are per draw, in milliseconds
+                printf("bench: %-32s min %9.5f  median %9.5f  p90 %9.5f  stddev %8.5f  [%d x %d]",
+                       runName.c_str(), stats.fMin, stats.fMedian, stats.fP90, stats.fStddev,
+                       stats.fSamples, stats.fLoops);
+                if (stats.fMPixelsPerSec > 0) {
+                    printf("  %8.1f MP/s", stats.fMPixelsPerSec);
+                }
+                auto base = baseline.find(runName);
+                if (base != baseline.end()) {
+                    double delta = stats.fMedian / base->second.fMedian - 1;
+                    double threshold = regression_threshold(stats, base->second, minDelta);
+                    const char* verdict = "";
+                    if (is_regression(stats, base->second, threshold, minDelta)) {
+                        verdict = "  REGRESSION";
+                        regressions += 1;
+                    } else if (is_regression(base->second, stats, threshold, minDelta)) {
+                        verdict = "  improved";
+                    }
+                    printf("  %+6.1f%% (+-%.1f%%, min %+.1f%%)%s", delta * 100, threshold * 100,
+                           (stats.fMin / base->second.fMin - 1) * 100, verdict);
+                } else if (baselinePath) {
+                    printf("  (not in baseline)");
+                }
+                printf("\n");
+                fflush(stdout);
+                results.push_back({ runName, stats });
+            }
 
-        free(testBM.pixels());
+            free(testBM.pixels());
+        }
+    }
+
+    if ((jsonPath && !write_results(jsonPath, results, true)) ||
+        (csvPath && !write_results(csvPath, results, false))) {
+        return -1;
+    }
+    if (baselinePath) {
+        printf("%d regression%s against %s\n", regressions, regressions == 1 ? "" : "s", baselinePath);
     }
-    return 0;
+    return regressions ? 1 : 0;
 }
@@ -19,6 +19,19 @@ public:
     virtual GISize size() const = 0;
     virtual void draw(GCanvas*) = 0;
 
+    /**
+     *  The pixels one draw() shades or blends, for reporting megapixels per second, or 0 if the
+     *  bench has no meaningful count.
+     */
+    virtual double pixelsPerDraw() const { return 0; }
+
+    /**
+     *  For the size sweep: make draw() fill a canvas of this size, and size() return it. Returns
+     *  false (the default) to have the harness scale the CTM up from size() instead, which
+     *  magnifies the bench's geometry along with the canvas.
+     */
+    virtual bool resize(GISize) { return false; }
+
     typedef GBenchmark* (*Factory)();
 };
 
@@ -6,9 +6,16 @@
 #include "GCanvas.h"
 #include "GBitmap.h"
 #include "GColor.h"
+#include "GFilter.h"
+#include "GMatrix.h"
+#include "GPaint.h"
+#include "GPath.h"
 #include "GRandom.h"
 #include "GRect.h"
+#include "GShader.h"
+#include <memory>
 #include <string>
+#include <vector>
 
 static GColor rand_color(GRandom& rand, bool forceOpaque = false) {
     GColor c { rand.nextF(), rand.nextF(), rand.nextF(), rand.nextF() };
@@ -152,6 +159,280 @@ public:
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 
+// Where the scenes' paint lands, in the coordinates they draw in
+static const GRect gLionBounds = GRect::MakeLTRB(0, 2, 238, 379);
+static const GRect gCartmanBounds = GRect::MakeLTRB(13, 12, 467, 395);
+
+static void draw_lion(GCanvas* canvas) {
+#include "lion.inc"
+}
+
+static void draw_cartman(GCanvas* canvas) {
+    GPath path;
+    GPaint paint;
+#include "cartman.475"
+}
+
+/*
+ *  Replays a whole scene, scaled and rotated about the center of its content (whose bounds are
+ *  passed in), which is placed at the center of the canvas.
+ */
+class SceneBench : public GBenchmark {
+    enum { W = 512, H = 512 };
+    void      (*fDraw)(GCanvas*);
+    const GRect fBounds;
+    const float fScale;
+    const float fDegrees;
+    std::string fName;
+public:
+    SceneBench(void (*draw)(GCanvas*), const GRect& bounds, const char* name, float scale,
+               float degrees) : fDraw(draw), fBounds(bounds), fScale(scale), fDegrees(degrees) {
+        char suffix[32];
+        snprintf(suffix, sizeof(suffix), degrees ? "_x%g_r%g" : "_x%g", scale, degrees);
+        fName = std::string(name) + suffix;
+    }
+
+    const char* name() const override { return fName.c_str(); }
+    GISize size() const override { return { W, H }; }
+    void draw(GCanvas* canvas) override {
+        canvas->save();
+        canvas->translate(W * 0.5f, H * 0.5f);
+        canvas->rotate(fDegrees * M_PI / 180);
+        canvas->scale(fScale, fScale);
+        canvas->translate(-(fBounds.fLeft + fBounds.fRight) * 0.5f, -(fBounds.fTop + fBounds.fBottom) * 0.5f);
+        fDraw(canvas);
+        canvas->restore();
+    }
+};
+
+// A closed ring of count quads around center, whose control points alternate outside and inside it
+static GPath make_quad_ring(int count, GPoint center, float radius, float wave) {
+    GPath path;
+    path.moveTo(center.fX + radius, center.fY);
+    for (int i = 0; i < count; ++i) {
+        float mid = (i + 0.5f) * 2 * M_PI / count;
+        float end = (i + 1) * 2 * M_PI / count;
+        float r = (i & 1) ? radius - wave : radius + wave;
+        path.quadTo(center.fX + cos(mid) * r, center.fY + sin(mid) * r,
+                    center.fX + cos(end) * radius, center.fY + sin(end) * radius);
+    }
+    return path;
+}
+
+// A closed ring of count cubics around center, each an S-curve crossing it
+static GPath make_cubic_ring(int count, GPoint center, float radius, float wave) {
+    GPath path;
+    path.moveTo(center.fX + radius, center.fY);
+    for (int i = 0; i < count; ++i) {
+        float a1 = (i + 1.0f / 3) * 2 * M_PI / count;
+        float a2 = (i + 2.0f / 3) * 2 * M_PI / count;
+        float end = (i + 1) * 2 * M_PI / count;
+        float r1 = radius + wave;
+        float r2 = radius - wave;
+        path.cubicTo(center.fX + cos(a1) * r1, center.fY + sin(a1) * r1,
+                     center.fX + cos(a2) * r2, center.fY + sin(a2) * r2,
+                     center.fX + cos(end) * radius, center.fY + sin(end) * radius);
+    }
+    return path;
+}
+
+// count rings (a circle with a smaller one inside, wound the other way), scattered over bounds
+static GPath make_rings(int count, const GRect& bounds, float maxRadius) {
+    GRandom rand;
+    GPath path;
+    for (int i = 0; i < count; ++i) {
+        GPoint center = { bounds.left() + rand.nextF() * bounds.width(),
+                          bounds.top() + rand.nextF() * bounds.height() };
+        float r = 2 + rand.nextF() * maxRadius;
+        path.addCircle(center, r, GPath::kCW_Direction);
+        path.addCircle(center, r * 0.75f, GPath::kCCW_Direction);
+    }
+    return path;
+}
+
+/*
+ *  Draws one large path (built once, up front), so the time is all edge building, curve
+ *  flattening and scan conversion.
+ */
+class PathBench : public GBenchmark {
+    enum { W = 512, H = 512 };
+    const GPath fPath;
+    const char* fName;
+public:
+    PathBench(const GPath& path, const char* name) : fPath(path), fName(name) {}
+
+    const char* name() const override { return fName; }
+    GISize size() const override { return { W, H }; }
+    void draw(GCanvas* canvas) override {
+        canvas->drawPath(fPath, GPaint({ 1, 0.25f, 0.5f, 0.75f }));
+    }
+};
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+static const char* gTileNames[] = { "clamp", "repeat", "mirror" };
+static const char* gQualityNames[] = { "nearest", "bilinear", "trilinear" };
+static const char* gModeNames[] = {
+    "clear", "src", "dst", "srcover", "dstover", "srcin", "dstin", "srcout", "dstout", "srcatop",
+    "dstatop", "xor",
+};
+
+// The CTM the shader benches draw under
+enum MatrixKind {
+    kIdentity_MatrixKind,
+    kScale_MatrixKind,
+    kRotate_MatrixKind,
+    kDownscale_MatrixKind,
+};
+static const char* gMatrixNames[] = { "identity", "scale", "rotate", "downscale" };
+
+static GMatrix make_matrix(MatrixKind kind) {
+    switch (kind) {
+        case kIdentity_MatrixKind:  return GMatrix();
+        case kScale_MatrixKind:     return GMatrix::MakeScale(2.5f, 1.75f);
+        case kRotate_MatrixKind:    return GMatrix().postRotate(M_PI / 6);
+        // between mip levels 1 and 2, so trilinear blends two levels
+        case kDownscale_MatrixKind: return GMatrix::MakeScale(0.4f, 0.3f);
+    }
+    return GMatrix();
+}
+
+/*
+ *  Fills the whole canvas with a shader, and maybe a filter, so the time is all shading,
+ *  filtering and blending. Subclasses make the shader and filter, and name the bench.
+ *
+ *  It resizes for the sweep by just filling a bigger canvas: scaling the CTM instead would
+ *  change how the shader samples.
+ */
+class ShaderBench : public GBenchmark {
+protected:
+    enum { W = 256, H = 256 };
+    std::unique_ptr<GShader> fShader;
+    std::unique_ptr<GFilter> fFilter;
+    GMatrix                  fMatrix;
+    std::string              fName;
+    GISize                   fSize { W, H };
+public:
+    const char* name() const override { return fName.c_str(); }
+    GISize size() const override { return fSize; }
+    double pixelsPerDraw() const override { return (double)fSize.fWidth * fSize.fHeight; }
+    bool resize(GISize size) override {
+        fSize = size;
+        return true;
+    }
+    void draw(GCanvas* canvas) override {
+        GPaint paint(fShader.get());
+        paint.setFilter(fFilter.get());
+        canvas->save();
+        canvas->concat(fMatrix);
+        canvas->drawPaint(paint);
+        canvas->restore();
+    }
+};
+
+class BitmapShaderBench : public ShaderBench {
+    enum { BW = 64, BH = 64 };
+    std::vector<GPixel> fPixels;
+    GBitmap             fBitmap;
+public:
+    BitmapShaderBench(GShader::TileMode tile, MatrixKind matrix, GShader::FilterQuality quality) {
+        // An opaque pattern that changes every pixel, so no two neighbors sample alike
+        fPixels.resize(BW * BH);
+        for (int y = 0; y < BH; ++y) {
+            for (int x = 0; x < BW; ++x) {
+                fPixels[y * BW + x] = GPixel_PackARGB(0xFF, x * 4, y * 4, (x ^ y) * 4);
+            }
+        }
+        fBitmap.reset(BW, BH, BW * sizeof(GPixel), fPixels.data(), GBitmap::kYes_IsOpaque);
+        fShader = GCreateBitmapShader(fBitmap, GMatrix(), tile, quality);
+        fMatrix = make_matrix(matrix);
+        char name[64];
+        snprintf(name, sizeof(name), "bitmap_%s_%s_%s",
+                 gQualityNames[quality], gTileNames[tile], gMatrixNames[matrix]);
+        fName = name;
+    }
+};
+
+class GradientBench : public ShaderBench {
+public:
+    GradientBench(int stops, GShader::TileMode tile, MatrixKind matrix) {
+        GRandom rand;
+        std::vector<GColor> colors(stops);
+        for (GColor& c : colors) {
+            c = rand_color(rand);
+        }
+        // The gradient spans the middle of the canvas, so the tile mode decides the rest
+        fShader = GCreateLinearGradient({ W * 0.25f, H * 0.25f }, { W * 0.75f, H * 0.5f },
+                                        colors.data(), stops, tile);
+        fMatrix = make_matrix(matrix);
+        char name[64];
+        snprintf(name, sizeof(name), "gradient%d_%s_%s", stops, gTileNames[tile], gMatrixNames[matrix]);
+        fName = name;
+    }
+};
+
+/*
+ *  A filter on a solid color runs once per draw, so this filters a gradient, which runs it on
+ *  every pixel.
+ */
+class FilterBench : public ShaderBench {
+public:
+    FilterBench(GBlendMode mode) {
+        const GColor colors[] = { { 0.75f, 1, 0, 0 }, { 1, 0, 0.5f, 1 } };
+        fShader = GCreateLinearGradient({ 0, 0 }, { W, H }, colors, 2);
+        fFilter = GCreateBlendFilter(mode, { 0.5f, 0.25f, 0.75f, 0.5f });
+        fName = std::string("filter_") + gModeNames[static_cast<int>(mode)];
+    }
+};
+
+/*
+ *  Nests depth layers, fills each with a translucent rect, and restores them all. A layer is
+ *  cleared, filled and composited once, so those are the pixels counted for each.
+ */
+class LayerBench : public GBenchmark {
+    enum { W = 256, H = 256 };
+    const int   fDepth;
+    const bool  fBounded;
+    std::string fName;
+
+    // Bounds cover the middle quarter of the canvas
+    GRect bounds() const { return GRect::MakeLTRB(W * 0.25f, H * 0.25f, W * 0.75f, H * 0.75f); }
+public:
+    LayerBench(int depth, bool bounded) : fDepth(depth), fBounded(bounded) {
+        char name[32];
+        snprintf(name, sizeof(name), bounded ? "layers%d_bounds" : "layers%d", depth);
+        fName = name;
+    }
+
+    const char* name() const override { return fName.c_str(); }
+    GISize size() const override { return { W, H }; }
+    double pixelsPerDraw() const override {
+        return fDepth * (fBounded ? this->bounds().width() * this->bounds().height() : W * H);
+    }
+    void draw(GCanvas* canvas) override {
+        const GRect bounds = this->bounds();
+        const GPaint fill({ 0.5f, 0.25f, 0.5f, 0.75f });
+        for (int i = 0; i < fDepth; ++i) {
+            canvas->saveLayer(fBounded ? &bounds : nullptr, GPaint());
+            canvas->drawRect(GRect::MakeWH(W, H), fill);
+        }
+        for (int i = 0; i < fDepth; ++i) {
+            canvas->restore();
+        }
+    }
+};
+
+template <GShader::TileMode tile, MatrixKind matrix, GShader::FilterQuality quality>
+GBenchmark* make_bitmap_bench() { return new BitmapShaderBench(tile, matrix, quality); }
+
+template <int stops, GShader::TileMode tile, MatrixKind matrix>
+GBenchmark* make_gradient_bench() { return new GradientBench(stops, tile, matrix); }
+
+template <GBlendMode mode>
+GBenchmark* make_filter_bench() { return new FilterBench(mode); }
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
 const GBenchmark::Factory gBenchFactories[] {
     []() -> GBenchmark* { return new RectsBench(false); },
     []() -> GBenchmark* { return new RectsBench(true);  },
@@ -170,5 +451,86 @@ const GBenchmark::Factory gBenchFactories[] {
     []() -> GBenchmark* { return new ModesBench({0.5, 1, 0.5, 0.25}, "modes_half"); },
     []() -> GBenchmark* { return new ModesBench({1.0, 1, 0.5, 0.25}, "modes_1"); },
 
+    []() -> GBenchmark* { return new SceneBench(draw_lion, gLionBounds, "lion", 0.5f, 0); },
+    []() -> GBenchmark* { return new SceneBench(draw_lion, gLionBounds, "lion", 1, 0); },
+    []() -> GBenchmark* { return new SceneBench(draw_lion, gLionBounds, "lion", 1, 30); },
+    []() -> GBenchmark* { return new SceneBench(draw_lion, gLionBounds, "lion", 3, 0); },
+    []() -> GBenchmark* { return new SceneBench(draw_lion, gLionBounds, "lion", 3, 75); },
+    []() -> GBenchmark* { return new SceneBench(draw_cartman, gCartmanBounds, "cartman", 0.5f, 0); },
+    []() -> GBenchmark* { return new SceneBench(draw_cartman, gCartmanBounds, "cartman", 1, 0); },
+    []() -> GBenchmark* { return new SceneBench(draw_cartman, gCartmanBounds, "cartman", 1, 30); },
+    []() -> GBenchmark* { return new SceneBench(draw_cartman, gCartmanBounds, "cartman", 3, 0); },
+    []() -> GBenchmark* { return new SceneBench(draw_cartman, gCartmanBounds, "cartman", 3, 75); },
+
+    []() -> GBenchmark* {
+        return new PathBench(make_quad_ring(4000, { 256, 256 }, 200, 20), "path_quads");
+    },
+    []() -> GBenchmark* {
+        return new PathBench(make_cubic_ring(4000, { 256, 256 }, 200, 20), "path_cubics");
+    },
+    []() -> GBenchmark* {
+        return new PathBench(make_rings(1000, GRect::MakeWH(512, 512), 60), "path_contours");
+    },
+
+    make_bitmap_bench<GShader::kClamp, kIdentity_MatrixKind, GShader::kNearest>,
+    make_bitmap_bench<GShader::kClamp, kScale_MatrixKind, GShader::kNearest>,
+    make_bitmap_bench<GShader::kClamp, kRotate_MatrixKind, GShader::kNearest>,
+    make_bitmap_bench<GShader::kRepeat, kIdentity_MatrixKind, GShader::kNearest>,
+    make_bitmap_bench<GShader::kRepeat, kScale_MatrixKind, GShader::kNearest>,
+    make_bitmap_bench<GShader::kRepeat, kRotate_MatrixKind, GShader::kNearest>,
+    make_bitmap_bench<GShader::kMirror, kIdentity_MatrixKind, GShader::kNearest>,
+    make_bitmap_bench<GShader::kMirror, kScale_MatrixKind, GShader::kNearest>,
+    make_bitmap_bench<GShader::kMirror, kRotate_MatrixKind, GShader::kNearest>,
+    make_bitmap_bench<GShader::kClamp, kIdentity_MatrixKind, GShader::kBilinear>,
+    make_bitmap_bench<GShader::kClamp, kScale_MatrixKind, GShader::kBilinear>,
+    make_bitmap_bench<GShader::kClamp, kRotate_MatrixKind, GShader::kBilinear>,
+    make_bitmap_bench<GShader::kRepeat, kIdentity_MatrixKind, GShader::kBilinear>,
+    make_bitmap_bench<GShader::kRepeat, kScale_MatrixKind, GShader::kBilinear>,
+    make_bitmap_bench<GShader::kRepeat, kRotate_MatrixKind, GShader::kBilinear>,
+    make_bitmap_bench<GShader::kMirror, kIdentity_MatrixKind, GShader::kBilinear>,
+    make_bitmap_bench<GShader::kMirror, kScale_MatrixKind, GShader::kBilinear>,
+    make_bitmap_bench<GShader::kMirror, kRotate_MatrixKind, GShader::kBilinear>,
+    make_bitmap_bench<GShader::kRepeat, kDownscale_MatrixKind, GShader::kBilinear>,
+    make_bitmap_bench<GShader::kClamp, kDownscale_MatrixKind, GShader::kTrilinear>,
+    make_bitmap_bench<GShader::kRepeat, kDownscale_MatrixKind, GShader::kTrilinear>,
+    make_bitmap_bench<GShader::kMirror, kDownscale_MatrixKind, GShader::kTrilinear>,
+
+    make_gradient_bench<2, GShader::kClamp, kIdentity_MatrixKind>,
+    make_gradient_bench<2, GShader::kClamp, kScale_MatrixKind>,
+    make_gradient_bench<2, GShader::kClamp, kRotate_MatrixKind>,
+    make_gradient_bench<2, GShader::kRepeat, kIdentity_MatrixKind>,
+    make_gradient_bench<2, GShader::kRepeat, kScale_MatrixKind>,
+    make_gradient_bench<2, GShader::kRepeat, kRotate_MatrixKind>,
+    make_gradient_bench<2, GShader::kMirror, kIdentity_MatrixKind>,
+    make_gradient_bench<2, GShader::kMirror, kScale_MatrixKind>,
+    make_gradient_bench<2, GShader::kMirror, kRotate_MatrixKind>,
+    make_gradient_bench<16, GShader::kClamp, kIdentity_MatrixKind>,
+    make_gradient_bench<16, GShader::kClamp, kScale_MatrixKind>,
+    make_gradient_bench<16, GShader::kClamp, kRotate_MatrixKind>,
+    make_gradient_bench<16, GShader::kRepeat, kIdentity_MatrixKind>,
+    make_gradient_bench<16, GShader::kRepeat, kScale_MatrixKind>,
+    make_gradient_bench<16, GShader::kRepeat, kRotate_MatrixKind>,
+    make_gradient_bench<16, GShader::kMirror, kIdentity_MatrixKind>,
+    make_gradient_bench<16, GShader::kMirror, kScale_MatrixKind>,
+    make_gradient_bench<16, GShader::kMirror, kRotate_MatrixKind>,
+
+    make_filter_bench<GBlendMode::kClear>,
+    make_filter_bench<GBlendMode::kSrc>,
+    make_filter_bench<GBlendMode::kDst>,
+    make_filter_bench<GBlendMode::kSrcOver>,
+    make_filter_bench<GBlendMode::kDstOver>,
+    make_filter_bench<GBlendMode::kSrcIn>,
+    make_filter_bench<GBlendMode::kDstIn>,
+    make_filter_bench<GBlendMode::kSrcOut>,
+    make_filter_bench<GBlendMode::kDstOut>,
+    make_filter_bench<GBlendMode::kSrcATop>,
+    make_filter_bench<GBlendMode::kDstATop>,
+    make_filter_bench<GBlendMode::kXor>,
+
+    []() -> GBenchmark* { return new LayerBench(1, false); },
+    []() -> GBenchmark* { return new LayerBench(1, true); },
+    []() -> GBenchmark* { return new LayerBench(4, false); },
+    []() -> GBenchmark* { return new LayerBench(4, true); },
+
     nullptr,
 };
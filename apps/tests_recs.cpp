@@ -5,9 +5,20 @@
 #include "GCanvas.h"
 #include "GBitmap.h"
 #include "GColor.h"
+#include "GFilter.h"
+#include "GPath.h"
+#include "GPicture.h"
 #include "GPoint.h"
 #include "GRect.h"
+#include "GRandom.h"
 #include "tests.h"
+#include "GShader.h"
+#include <functional>
+#include <string>
+#include <vector>
+#include <unistd.h>
+#include "../Bilerp.h"
+#include "../Blend.h"
 
 static void setup_bitmap(GBitmap* bitmap, int w, int h) {
     size_t rb = w << 2;
@@ -299,6 +310,940 @@ static void test_matrix_map(GTestStats* stats) {
 #include "tests_pa5.cpp"
 #include "tests_pa6.cpp"
 
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+static GPixel random_premul(GRandom& rand) {
+    // favor the alphas the kernels special-case
+    int a = rand.nextRange(0, 3) == 0 ? 255 * rand.nextRange(0, 1) : rand.nextRange(0, 255);
+    return GPixel_PackARGB(a, rand.nextRange(0, a), rand.nextRange(0, a), rand.nextRange(0, a));
+}
+
+static bool has_avx2() {
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2");
+#else
+    return false;
+#endif
+}
+
+// counts that cover whole vectors, partial vectors, and the scalar tail of each
+static const int gBlendCounts[] = { 1, 3, 4, 7, 8, 9, 16, 33, 67 };
+static const int kMaxBlendCount = 67;
+
+static bool blend_row_matches(BlendRowProc proc, BlendRowProc scalar,
+                              const GPixel src[], const GPixel dst[]) {
+    for (int count : gBlendCounts) {
+        GPixel expected[kMaxBlendCount], actual[kMaxBlendCount];
+        memcpy(expected, dst, count * sizeof(GPixel));
+        memcpy(actual, dst, count * sizeof(GPixel));
+        scalar(expected, src, count);
+        proc(actual, src, count);
+        if (memcmp(expected, actual, count * sizeof(GPixel))) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// a null proc means the draw leaves dst alone
+static bool blend_const_matches(BlendConstProc proc, BlendConstProc scalar,
+                                GPixel src, const GPixel dst[]) {
+    for (int count : gBlendCounts) {
+        GPixel expected[kMaxBlendCount], actual[kMaxBlendCount];
+        memcpy(expected, dst, count * sizeof(GPixel));
+        memcpy(actual, dst, count * sizeof(GPixel));
+        scalar(expected, src, count);
+        if (proc) {
+            proc(actual, src, count);
+        }
+        if (memcmp(expected, actual, count * sizeof(GPixel))) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void test_blend_simd(GTestStats* stats) {
+    GRandom rand;
+    GPixel src[kMaxBlendCount], dst[kMaxBlendCount];
+    for (int i = 0; i < kMaxBlendCount; ++i) {
+        src[i] = random_premul(rand);
+        dst[i] = random_premul(rand);
+    }
+
+    const BlendRowProc* rowTables[] = {
+        GetBlendRowProcs_SSE2(), has_avx2() ? GetBlendRowProcs_AVX2() : nullptr,
+    };
+    const BlendConstProc* constTables[] = {
+        GetBlendConstProcs_SSE2(), has_avx2() ? GetBlendConstProcs_AVX2() : nullptr,
+    };
+    const GPixel constSrcs[] = {
+        0, GPixel_PackARGB(0xFF, 0x80, 0x40, 0), GPixel_PackARGB(0x80, 0x80, 0x7F, 1), src[5],
+    };
+
+    for (int m = 0; m <= (int)GBlendMode::kXor; ++m) {
+        const GBlendMode mode = (GBlendMode)m;
+        const BlendRowProc scalarRow = GetScalarBlendRowProc(mode);
+        const BlendConstProc scalarConst = GetScalarBlendConstProc(mode);
+
+        bool rowOK = blend_row_matches(GetBlendRowProc(mode), scalarRow, src, dst);
+        for (const BlendRowProc* table : rowTables) {
+            if (table && table[m]) {
+                rowOK &= blend_row_matches(table[m], scalarRow, src, dst);
+            }
+        }
+        stats->expectTrue(rowOK, "blend_simd_row");
+
+        bool constOK = true;
+        for (GPixel c : constSrcs) {
+            constOK &= blend_const_matches(GetBlendConstProc(mode, c), scalarConst, c, dst);
+            for (const BlendConstProc* table : constTables) {
+                if (table && table[m]) {
+                    constOK &= blend_const_matches(table[m], scalarConst, c, dst);
+                }
+            }
+        }
+        stats->expectTrue(constOK, "blend_simd_const");
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+static bool pixel_near(GPixel a, GPixel b, int tolerance) {
+    return abs(GPixel_GetA(a) - GPixel_GetA(b)) <= tolerance &&
+           abs(GPixel_GetR(a) - GPixel_GetR(b)) <= tolerance &&
+           abs(GPixel_GetG(a) - GPixel_GetG(b)) <= tolerance &&
+           abs(GPixel_GetB(a) - GPixel_GetB(b)) <= tolerance;
+}
+
+static bool bitmap_eq(const GBitmap& a, const GBitmap& b) {
+    for (int y = 0; y < a.height(); ++y) {
+        if (memcmp(a.getAddr(0, y), b.getAddr(0, y), a.width() * sizeof(GPixel))) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void test_bilerp_simd(GTestStats* stats) {
+    const int N = 37;
+    GRandom rand;
+    GPixel tl[N], tr[N], bl[N], br[N], expected[N], actual[N];
+    uint16_t fx[N], fy[N];
+    for (int i = 0; i < N; ++i) {
+        tl[i] = random_premul(rand);
+        tr[i] = random_premul(rand);
+        bl[i] = random_premul(rand);
+        br[i] = random_premul(rand);
+        fx[i] = rand.nextRange(0, 256);
+        fy[i] = rand.nextRange(0, 256);
+    }
+    GetScalarBilerpRowProc()(expected, tl, tr, bl, br, fx, fy, N);
+
+    GetBilerpRowProc()(actual, tl, tr, bl, br, fx, fy, N);
+    stats->expectTrue(!memcmp(expected, actual, sizeof(actual)), "bilerp_simd_dispatch");
+    if (BilerpRowProc sse2 = GetBilerpRowProc_SSE2()) {
+        sse2(actual, tl, tr, bl, br, fx, fy, N);
+        stats->expectTrue(!memcmp(expected, actual, sizeof(actual)), "bilerp_simd_sse2");
+    }
+}
+
+static void test_bitmap_filtering(GTestStats* stats) {
+    GRandom rand;
+    GBitmap bitmap;
+    bitmap.alloc(8, 8);
+    for (int y = 0; y < 8; ++y) {
+        for (int x = 0; x < 8; ++x) {
+            *bitmap.getAddr(x, y) = random_premul(rand);
+        }
+    }
+
+    // unscaled, every pixel center lands on a texel center, so filtering changes nothing
+    for (auto quality : { GShader::kBilinear, GShader::kTrilinear }) {
+        GSurface surface(8, 8);
+        auto shader = GCreateBitmapShader(bitmap, GMatrix(), GShader::kClamp, quality);
+        surface.canvas()->drawPaint(GPaint(shader.get()));
+        stats->expectTrue(bitmap_eq(surface.bitmap(), bitmap), "bitmap_filter_identity");
+    }
+
+    // black | white, stretched 2x: the inner pixel centers sit a quarter texel either side of the seam
+    const GPixel black = GPixel_PackARGB(0xFF, 0, 0, 0);
+    const GPixel white = GPixel_PackARGB(0xFF, 0xFF, 0xFF, 0xFF);
+    GBitmap pair;
+    pair.alloc(2, 1);
+    *pair.getAddr(0, 0) = black;
+    *pair.getAddr(1, 0) = white;
+    {
+        GSurface surface(4, 1);
+        auto shader = GCreateBitmapShader(pair, GMatrix(), GShader::kClamp, GShader::kBilinear);
+        surface.canvas()->scale(2, 1);
+        surface.canvas()->drawPaint(GPaint(shader.get()));
+        const GPixel expected[] = {
+            black, GPixel_PackARGB(0xFF, 64, 64, 64), GPixel_PackARGB(0xFF, 191, 191, 191), white,
+        };
+        bool ok = true;
+        for (int x = 0; x < 4; ++x) {
+            ok &= pixel_near(*surface.bitmap().getAddr(x, 0), expected[x], 1);
+        }
+        stats->expectTrue(ok, "bitmap_bilinear_magnify");
+    }
+
+    // a 1-pixel checkerboard shrunk 4x (exactly one mip level) and 3.3x (between two) averages to gray
+    GBitmap checker;
+    checker.alloc(16, 16);
+    for (int y = 0; y < 16; ++y) {
+        for (int x = 0; x < 16; ++x) {
+            *checker.getAddr(x, y) = (x + y) & 1 ? white : black;
+        }
+    }
+    for (float scale : { 0.25f, 0.3f }) {
+        GSurface surface(4, 4);
+        auto shader = GCreateBitmapShader(checker, GMatrix(), GShader::kClamp, GShader::kTrilinear);
+        surface.canvas()->scale(scale, scale);
+        surface.canvas()->drawPaint(GPaint(shader.get()));
+        bool ok = true;
+        for (int y = 0; y < 4; ++y) {
+            for (int x = 0; x < 4; ++x) {
+                ok &= pixel_near(*surface.bitmap().getAddr(x, y), GPixel_PackARGB(0xFF, 128, 128, 128), 2);
+            }
+        }
+        stats->expectTrue(ok, "bitmap_trilinear_minify");
+    }
+    free(bitmap.pixels());
+    free(pair.pixels());
+    free(checker.pixels());
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+// A red-to-blue gradient drawn over the whole bitmap must match param(x, y) at every pixel center,
+// where param returns the gradient's t (already tiled), or a negative t to skip that pixel.
+template <typename Param> static bool matches_red_blue(const GBitmap& bitmap, Param param) {
+    for (int y = 0; y < bitmap.height(); ++y) {
+        for (int x = 0; x < bitmap.width(); ++x) {
+            float t = param(x + 0.5f, y + 0.5f);
+            if (t < 0) {
+                continue;
+            }
+            GPixel expected = GPixel_PackARGB(0xFF, GRoundToInt(255 * (1 - t)), 0, GRoundToInt(255 * t));
+            if (!pixel_near(*bitmap.getAddr(x, y), expected, 2)) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+static void test_radial_sweep(GTestStats* stats) {
+    const GColor colors[] = { GColor::MakeARGB(1, 1, 0, 0), GColor::MakeARGB(1, 0, 0, 1) };
+    const float kTwoPi = 2 * M_PI;
+
+    {
+        GSurface surface(20, 20);
+        auto shader = GCreateRadialGradient({8, 9}, 8, colors, 2);
+        surface.canvas()->drawPaint(GPaint(shader.get()));
+        stats->expectTrue(matches_red_blue(surface.bitmap(), [](float x, float y) {
+            return std::min(hypotf(x - 8, y - 9) / 8, 1.0f);
+        }), "radial_clamp");
+    }
+    {
+        GSurface surface(20, 20);
+        auto shader = GCreateRadialGradient({8, 9}, 5, colors, 2, GShader::kRepeat);
+        surface.canvas()->drawPaint(GPaint(shader.get()));
+        stats->expectTrue(matches_red_blue(surface.bitmap(), [](float x, float y) {
+            float t = hypotf(x - 8, y - 9) / 5;
+            t -= floorf(t);
+            // right at the wrap, the table may round either way
+            return t < 0.01f || t > 0.99f ? -1 : t;
+        }), "radial_repeat");
+    }
+    {
+        // scaling the canvas scales the circles
+        GSurface surface(20, 20);
+        auto shader = GCreateRadialGradient({4, 4}, 4, colors, 2);
+        surface.canvas()->scale(2, 2);
+        surface.canvas()->drawPaint(GPaint(shader.get()));
+        stats->expectTrue(matches_red_blue(surface.bitmap(), [](float x, float y) {
+            return std::min(hypotf(x - 8, y - 8) / 8, 1.0f);
+        }), "radial_scaled");
+    }
+    {
+        GSurface surface(20, 20);
+        auto shader = GCreateSweepGradient({10, 9}, 0, kTwoPi, colors, 2);
+        surface.canvas()->drawPaint(GPaint(shader.get()));
+        stats->expectTrue(matches_red_blue(surface.bitmap(), [=](float x, float y) {
+            float angle = atan2f(y - 9, x - 10);
+            return (angle < 0 ? angle + kTwoPi : angle) / kTwoPi;
+        }), "sweep_full");
+    }
+    {
+        // a quarter turn from straight down to straight left, clamped over the rest of the turn
+        GSurface surface(20, 20);
+        auto shader = GCreateSweepGradient({10, 9}, M_PI / 2, M_PI, colors, 2);
+        surface.canvas()->drawPaint(GPaint(shader.get()));
+        stats->expectTrue(matches_red_blue(surface.bitmap(), [=](float x, float y) {
+            float angle = atan2f(y - 9, x - 10) - M_PI / 2;
+            angle = angle < 0 ? angle + kTwoPi : angle;
+            return std::min(angle / (float)(M_PI / 2), 1.0f);
+        }), "sweep_partial");
+    }
+    {
+        // one color fills everything with it, premultiplied, whatever the tile mode
+        const GColor solid[] = { GColor::MakeARGB(0.5f, 1, 0, 0) };
+        const GPixel expected = GPixel_PackARGB(128, 128, 0, 0);
+        for (int tile = GShader::kClamp; tile <= GShader::kMirror; ++tile) {
+            GSurface radialSurface(20, 20);
+            auto radial = GCreateRadialGradient({8, 9}, 5, solid, 1, (GShader::TileMode)tile);
+            radialSurface.canvas()->drawPaint(GPaint(radial.get()));
+            stats->expectTrue(is_filled_with(radialSurface.bitmap(), expected), "radial_one_color");
+
+            GSurface sweepSurface(20, 20);
+            auto sweep = GCreateSweepGradient({10, 9}, 0, M_PI, solid, 1, (GShader::TileMode)tile);
+            sweepSurface.canvas()->drawPaint(GPaint(sweep.get()));
+            stats->expectTrue(is_filled_with(sweepSurface.bitmap(), expected), "sweep_one_color");
+        }
+    }
+
+    stats->expectNULL(GCreateRadialGradient({0, 0}, 0, colors, 2).get(), "radial_bad_radius");
+    stats->expectNULL(GCreateSweepGradient({0, 0}, 1, 1, colors, 2).get(), "sweep_bad_angles");
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+// Solid, blended, transformed, shaded and layered draws, spread over every band of a tall canvas.
+// The shaders and filter are freed as soon as their draws return.
+static void draw_test_scene(GCanvas* canvas, const GBitmap& texture) {
+    canvas->clear({1, 1, 1, 1});
+    for (int i = 0; i < 12; ++i) {
+        GPaint paint({0.5f, i / 12.0f, 0.5f, 1 - i / 12.0f});
+        paint.setBlendMode((GBlendMode)(i % ((int)GBlendMode::kXor + 1)));
+        canvas->drawRect(GRect::MakeXYWH(i * 7.3f, i * 24.7f, 40, 50), paint);
+    }
+
+    canvas->save();
+    canvas->translate(50, 150);
+    canvas->rotate(0.3f);
+    const GPoint tri[] = { {-40, -60}, {45, -10}, {-10, 70} };
+    canvas->drawConvexPolygon(tri, 3, GPaint({0.8f, 0, 0.6f, 0.2f}));
+    GPath path;
+    path.moveTo(-45, 0).quadTo(0, -90, 45, 0).cubicTo(20, 60, -20, 60, -45, 0);
+    path.addCircle({0, 0}, 20, GPath::kCCW_Direction);
+    canvas->drawPath(path, GPaint({1, 0.1f, 0.3f, 0.9f}));
+    canvas->restore();
+
+    for (int i = 0; i < 4; ++i) {
+        const GColor colors[] = { {1, 1, 0, 0}, {0.5f, 0, 1, 0}, {1, 0, 0, i / 4.0f} };
+        auto shader = GCreateLinearGradient({0, 200}, {100, 260 + i * 10.0f}, colors, 3);
+        canvas->drawRect(GRect::MakeXYWH(i * 25, 190 + i * 10, 30, 40), GPaint(shader.get()));
+    }
+
+    canvas->save();
+    canvas->translate(60, 250);
+    canvas->scale(3, 2);
+    canvas->rotate(-0.4f);
+    auto bitmapShader = GCreateBitmapShader(texture, GMatrix(), GShader::kRepeat, GShader::kBilinear);
+    canvas->drawRect(GRect::MakeXYWH(-10, -10, 20, 25), GPaint(bitmapShader.get()));
+    canvas->restore();
+
+    auto filter = GCreateBlendFilter(GBlendMode::kSrcATop, {0.5f, 0, 0, 1});
+    const GRect layerBounds = GRect::MakeXYWH(10, 40, 70, 200);
+    canvas->saveLayer(&layerBounds, GPaint(filter.get()));
+    canvas->drawRect(GRect::MakeXYWH(0, 60, 100, 30), GPaint({1, 0, 1, 0}));
+    canvas->drawRect(GRect::MakeXYWH(20, 100, 30, 120), GPaint({0.7f, 1, 1, 0}));
+    canvas->restore();
+}
+
+static void make_texture(GBitmap* texture) {
+    GRandom rand(3);
+    texture->alloc(6, 5);
+    for (int y = 0; y < texture->height(); ++y) {
+        for (int x = 0; x < texture->width(); ++x) {
+            *texture->getAddr(x, y) = random_premul(rand);
+        }
+    }
+}
+
+// A solid shader that counts the clones made of it, and of them
+class CountingShader : public GShader {
+public:
+    CountingShader(GPixel pixel, int* cloneCount) : fPixel(pixel), fCloneCount(cloneCount) {}
+
+    bool isOpaque() override { return GPixel_GetA(fPixel) == 0xFF; }
+    bool setContext(const GMatrix&) override { return true; }
+    void shadeRow(int x, int y, int count, GPixel row[]) override {
+        for (int i = 0; i < count; ++i) {
+            row[i] = fPixel;
+        }
+    }
+    std::unique_ptr<GShader> clone() const override {
+        *fCloneCount += 1;
+        return std::unique_ptr<GShader>(new CountingShader(fPixel, fCloneCount));
+    }
+
+private:
+    GPixel  fPixel;
+    int*    fCloneCount;
+};
+
+static void test_tiled_canvas(GTestStats* stats) {
+    const int W = 100, H = 300;
+    GBitmap texture;
+    make_texture(&texture);
+
+    GSurface direct(W, H);
+    draw_test_scene(direct.canvas(), texture);
+    for (int threads : { 1, 3, 8 }) {
+        GBitmap bitmap;
+        bitmap.alloc(W, H);
+        {
+            auto tiled = GCreateTiledCanvas(bitmap, threads);
+            draw_test_scene(tiled.get(), texture);
+        }
+        stats->expectTrue(bitmap_eq(bitmap, direct.bitmap()), "tiled_scene");
+
+        // flushing part way through changes nothing
+        {
+            auto tiled = GCreateTiledCanvas(bitmap, threads);
+            tiled->clear({0, 0, 0, 0});
+            tiled->flush();
+            draw_test_scene(tiled.get(), texture);
+            tiled->flush();
+        }
+        stats->expectTrue(bitmap_eq(bitmap, direct.bitmap()), "tiled_flush");
+        free(bitmap.pixels());
+    }
+
+    // one shader used by many draws is cloned once for the recording, and once per band
+    int clones = 0;
+    {
+        GBitmap bitmap;
+        bitmap.alloc(W, H);
+        auto tiled = GCreateTiledCanvas(bitmap, 4);
+        CountingShader shader(GPixel_PackARGB(0xFF, 0, 0x80, 0), &clones);
+        for (int i = 0; i < 10; ++i) {
+            tiled->drawRect(GRect::MakeXYWH(i, i * 30, 50, 40), GPaint(&shader));
+        }
+        tiled.reset();
+        free(bitmap.pixels());
+    }
+    const int bands = (H + 63) / 64;
+    stats->expectTrue(clones > 0 && clones <= 1 + bands, "tiled_clone_once");
+
+    free(texture.pixels());
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+static void test_picture_playback(GTestStats* stats) {
+    const int W = 100, H = 300;
+    GBitmap texture;
+    make_texture(&texture);
+
+    auto recorder = GCreateRecordingCanvas();
+    draw_test_scene(recorder.get(), texture);
+    auto picture = recorder->finishRecording();
+    stats->expectPtr(picture.get(), "picture_finish");
+
+    GSurface direct(W, H);
+    draw_test_scene(direct.canvas(), texture);
+
+    // the scene's shaders and filter are gone, so this only works if the picture kept its own
+    GSurface played(W, H);
+    picture->playback(played.canvas());
+    stats->expectTrue(bitmap_eq(played.bitmap(), direct.bitmap()), "picture_playback");
+    picture->playback(played.canvas());
+    stats->expectTrue(bitmap_eq(played.bitmap(), direct.bitmap()), "picture_playback_again");
+
+    GBitmap tiledBitmap;
+    tiledBitmap.alloc(W, H);
+    {
+        auto tiled = GCreateTiledCanvas(tiledBitmap, 4);
+        picture->playback(tiled.get());
+    }
+    stats->expectTrue(bitmap_eq(tiledBitmap, direct.bitmap()), "picture_playback_tiled");
+    free(tiledBitmap.pixels());
+
+    // playback draws on top of the canvas's CTM, and leaves it (and the save depth) as it was
+    const GPaint red({1, 1, 0, 0});
+    direct.canvas()->save();
+    direct.canvas()->translate(5, -7);
+    draw_test_scene(direct.canvas(), texture);
+    direct.canvas()->drawRect(GRect::MakeXYWH(10, 10, 20, 20), red);
+    direct.canvas()->restore();
+    direct.canvas()->drawRect(GRect::MakeXYWH(30, 30, 20, 20), red);
+    played.canvas()->save();
+    played.canvas()->translate(5, -7);
+    picture->playback(played.canvas());
+    played.canvas()->drawRect(GRect::MakeXYWH(10, 10, 20, 20), red);
+    played.canvas()->restore();
+    played.canvas()->drawRect(GRect::MakeXYWH(30, 30, 20, 20), red);
+    stats->expectTrue(bitmap_eq(played.bitmap(), direct.bitmap()), "picture_playback_ctm");
+
+    // open saves are balanced, and the next recording starts empty with an identity CTM
+    recorder->save();
+    recorder->translate(50, 50);
+    recorder->saveLayer(GPaint({0.5f, 0, 0, 0}));
+    recorder->drawRect(GRect::MakeWH(10, 10), red);
+    auto unbalanced = recorder->finishRecording();
+    recorder->drawRect(GRect::MakeWH(10, 10), red);
+    auto next = recorder->finishRecording();
+    stats->expectEQ(next->countCommands(), 1, "picture_restart_count");
+
+    GSurface a(W, H), b(W, H);
+    unbalanced->playback(a.canvas());
+    next->playback(a.canvas());
+    a.canvas()->drawRect(GRect::MakeXYWH(0, 20, 10, 10), red);
+    b.canvas()->save();
+    b.canvas()->translate(50, 50);
+    b.canvas()->saveLayer(GPaint({0.5f, 0, 0, 0}));
+    b.canvas()->drawRect(GRect::MakeWH(10, 10), red);
+    b.canvas()->restore();
+    b.canvas()->restore();
+    b.canvas()->drawRect(GRect::MakeWH(10, 10), red);
+    b.canvas()->drawRect(GRect::MakeXYWH(0, 20, 10, 10), red);
+    stats->expectTrue(bitmap_eq(a.bitmap(), b.bitmap()), "picture_unbalanced");
+
+    // a shader drawn many times is cloned (and its pixels copied) once per recording
+    int cloneCount = 0;
+    CountingShader counting(0xFF00FF00, &cloneCount);
+    for (int i = 0; i < 10; ++i) {
+        recorder->drawRect(GRect::MakeXYWH(i, i, 10, 10), GPaint(&counting));
+    }
+    recorder->finishRecording();
+    stats->expectEQ(cloneCount, 1, "picture_clone_once");
+
+    GBitmap big;
+    big.alloc(64, 64);
+    const size_t bigBytes = 64 * 64 * sizeof(GPixel);
+    memset(big.pixels(), 0xFF, bigBytes);
+    auto bitmapShader = GCreateBitmapShader(big, GMatrix());
+    recorder->drawRect(GRect::MakeWH(10, 10), GPaint(bitmapShader.get()));
+    auto once = recorder->finishRecording();
+    for (int i = 0; i < 100; ++i) {
+        recorder->drawRect(GRect::MakeWH(10, 10), GPaint(bitmapShader.get()));
+    }
+    auto many = recorder->finishRecording();
+    stats->expectTrue(once->approximateBytesUsed() >= bigBytes, "picture_counts_pixels");
+    stats->expectTrue(many->approximateBytesUsed() < once->approximateBytesUsed() + bigBytes,
+                      "picture_shares_pixels");
+    free(big.pixels());
+
+    free(texture.pixels());
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+// Solid colors only, since picture files cannot hold shaders or filters
+static void draw_solid_scene(GCanvas* canvas) {
+    canvas->clear({1, 0.9f, 0.9f, 1});
+    canvas->save();
+    canvas->translate(10, 5);
+    canvas->rotate(0.2f);
+    for (int i = 0; i < 6; ++i) {
+        GPaint paint({0.6f, i / 6.0f, 0.3f, 0.5f});
+        paint.setBlendMode((GBlendMode)(i + (int)GBlendMode::kSrcOver));
+        canvas->drawRect(GRect::MakeXYWH(i * 9, i * 7, 30, 25), paint);
+    }
+    canvas->restore();
+
+    const GPoint quad[] = { {60, 10}, {95, 20}, {90, 60}, {55, 45} };
+    canvas->drawConvexPolygon(quad, 4, GPaint({1, 0, 0.5f, 0}));
+
+    const GRect layerBounds = GRect::MakeXYWH(5, 50, 60, 45);
+    canvas->saveLayer(&layerBounds, GPaint({0.5f, 0, 0, 0}));
+    GPath path;
+    path.moveTo(10, 90).quadTo(40, 30, 70, 90).lineTo(40, 99);
+    path.addCircle({30, 70}, 12);
+    canvas->drawPath(path, GPaint({1, 0.2f, 0.2f, 0.9f}));
+    canvas->saveLayer(GPaint({1, 0, 0, 0}));
+    canvas->drawPaint(GPaint({0.25f, 0, 1, 0}));
+    canvas->restore();
+    canvas->restore();
+}
+
+static std::string temp_picture_path() {
+    char path[] = "/tmp/tests_picture_XXXXXX";
+    int fd = mkstemp(path);
+    if (fd >= 0) {
+        close(fd);
+    }
+    return path;
+}
+
+static std::vector<char> read_file(const std::string& path) {
+    std::vector<char> data;
+    if (FILE* file = fopen(path.c_str(), "rb")) {
+        char buffer[256];
+        size_t n;
+        while ((n = fread(buffer, 1, sizeof(buffer), file)) > 0) {
+            data.insert(data.end(), buffer, buffer + n);
+        }
+        fclose(file);
+    }
+    return data;
+}
+
+static void write_file(const std::string& path, const std::vector<char>& data, size_t size) {
+    if (FILE* file = fopen(path.c_str(), "wb")) {
+        fwrite(data.data(), 1, size, file);
+        fclose(file);
+    }
+}
+
+static void set32(std::vector<char>* data, size_t offset, uint32_t value) {
+    for (int i = 0; i < 4; ++i) {
+        (*data)[offset + i] = (char)(value >> (i * 8));
+    }
+}
+
+static void test_picture_file(GTestStats* stats) {
+    const int W = 100, H = 100;
+    const std::string path = temp_picture_path();
+
+    auto recorder = GCreateRecordingCanvas();
+    draw_solid_scene(recorder.get());
+    auto picture = recorder->finishRecording();
+    stats->expectTrue(GWritePicture(*picture, path.c_str()), "picture_file_write");
+
+    auto loaded = GReadPicture(path.c_str());
+    stats->expectPtr(loaded.get(), "picture_file_read");
+    if (loaded) {
+        GSurface direct(W, H), played(W, H);
+        draw_solid_scene(direct.canvas());
+        loaded->playback(played.canvas());
+        stats->expectTrue(bitmap_eq(played.bitmap(), direct.bitmap()), "picture_file_playback");
+    }
+
+    // shaders and filters cannot be written, and nothing is
+    GBitmap texture;
+    make_texture(&texture);
+    draw_test_scene(recorder.get(), texture);
+    auto shaded = recorder->finishRecording();
+    remove(path.c_str());
+    stats->expectFalse(GWritePicture(*shaded, path.c_str()), "picture_file_no_shaders");
+    stats->expectNULL(GReadPicture(path.c_str()).get(), "picture_file_missing");
+    free(texture.pixels());
+
+    // every truncation of a small file is rejected
+    recorder->save();
+    recorder->drawRect(GRect::MakeXYWH(10, 10, 50, 50), GPaint({1, 0, 0, 1}));
+    recorder->restore();
+    GWritePicture(*recorder->finishRecording(), path.c_str());
+    const std::vector<char> good = read_file(path);
+    bool truncatedOK = true;
+    for (size_t size = 0; size < good.size(); ++size) {
+        write_file(path, good, size);
+        truncatedOK &= GReadPicture(path.c_str()) == nullptr;
+    }
+    stats->expectTrue(truncatedOK, "picture_file_truncated");
+
+    // playback wraps the picture in a save/restore, and so does the file:
+    // save @16, save @24, drawRect @32 (paint @40, blend mode @56, rect @60), restore @76, restore @84
+    stats->expectEQ(good.size(), (size_t)92, "picture_file_layout");
+    if (good.size() == 92) {
+        const struct {
+            size_t      fOffset;
+            uint32_t    fValue;
+            const char* fMsg;
+        } recs[] = {
+            {  0, 0x43495058, "picture_file_bad_magic" },
+            {  4, 2,          "picture_file_bad_version" },
+            {  8, 6,          "picture_file_bad_count" },
+            { 12, 72,         "picture_file_bad_bytes" },
+            { 24, 99,         "picture_file_bad_type" },
+            { 36, 40,         "picture_file_bad_size" },
+            { 36, 46,         "picture_file_unaligned_size" },
+            { 56, 0x20,       "picture_file_bad_blend" },
+            { 84, 0,          "picture_file_unbalanced" },
+        };
+        for (const auto& rec : recs) {
+            std::vector<char> bad = good;
+            set32(&bad, rec.fOffset, rec.fValue);
+            write_file(path, bad, bad.size());
+            stats->expectNULL(GReadPicture(path.c_str()).get(), rec.fMsg);
+        }
+
+        std::vector<char> longer = good;
+        longer.push_back(0);
+        write_file(path, longer, longer.size());
+        stats->expectNULL(GReadPicture(path.c_str()).get(), "picture_file_trailing");
+    }
+    remove(path.c_str());
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+static GPath make_star(float cx, float cy, float r) {
+    GPath path;
+    for (int i = 0; i < 5; ++i) {
+        float angle = i * 4 * M_PI / 5 - M_PI / 2;
+        GPoint p = { cx + r * cosf(angle), cy + r * sinf(angle) };
+        if (i == 0) {
+            path.moveTo(p);
+        } else {
+            path.lineTo(p);
+        }
+    }
+    // the hole in the middle is wound the other way, so it stays filled
+    path.addCircle({cx, cy}, r * 0.3f, GPath::kCCW_Direction);
+    return path;
+}
+
+// Every pixel is expected's where the mask was drawn, and untouched (background) elsewhere
+static bool matches_through_mask(const GBitmap& actual, const GBitmap& expected,
+                                 const GBitmap& mask, GPixel background) {
+    for (int y = 0; y < actual.height(); ++y) {
+        for (int x = 0; x < actual.width(); ++x) {
+            GPixel want = *mask.getAddr(x, y) ? *expected.getAddr(x, y) : background;
+            if (*actual.getAddr(x, y) != want) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+static void test_clip(GTestStats* stats) {
+    const int W = 100, H = 100;
+    const GRect rect = GRect::MakeLTRB(20.3f, 15.6f, 70.4f, 80.5f);
+    const GPath star = make_star(50, 50, 45);
+    GMatrix rotate, unrotate;
+    rotate.setRotate(0.4f);
+    rotate.preTranslate(-50, -50);
+    rotate.postTranslate(50, 50);
+    rotate.invert(&unrotate);
+
+    // the clip to set, and the same shape drawn solid, as the mask of pixels it should let through
+    const struct {
+        std::function<void(GCanvas*)> fClip;
+        std::function<void(GCanvas*)> fShape;
+        bool        fRotated;
+        const char* fMsg;
+    } recs[] = {
+        { [&](GCanvas* c) { c->clipRect(rect); },
+          [&](GCanvas* c) { c->drawRect(rect, GPaint()); }, false, "clip_rect" },
+        { [&](GCanvas* c) { c->clipPath(star); },
+          [&](GCanvas* c) { c->drawPath(star, GPaint()); }, false, "clip_path" },
+        { [&](GCanvas* c) { c->clipRect(rect); c->clipPath(star); },
+          [&](GCanvas* c) { c->clipRect(rect); c->drawPath(star, GPaint()); }, false, "clip_rect_path" },
+        { [&](GCanvas* c) { c->concat(rotate); c->clipRect(rect); c->concat(unrotate); },
+          [&](GCanvas* c) { c->concat(rotate); c->drawRect(rect, GPaint()); }, true, "clip_rotated_rect" },
+        { [&](GCanvas* c) { c->clipRect(GRect::MakeLTRB(-10, -10, -5, -5)); },
+          [&](GCanvas* c) {}, false, "clip_empty" },
+    };
+
+    GSurface reference(W, H);
+    draw_solid_scene(reference.canvas());
+    // the rotated clip's draws go through rotate * unrotate, which is only nearly the identity
+    GSurface rotatedReference(W, H);
+    rotatedReference.canvas()->concat(rotate);
+    rotatedReference.canvas()->concat(unrotate);
+    draw_solid_scene(rotatedReference.canvas());
+
+    const std::string path = temp_picture_path();
+    for (const auto& rec : recs) {
+        GSurface mask(W, H);
+        mask.canvas()->clear({0, 0, 0, 0});
+        rec.fShape(mask.canvas());
+        const GBitmap& expected = rec.fRotated ? rotatedReference.bitmap() : reference.bitmap();
+
+        auto clipped_scene = [&](GCanvas* canvas) {
+            canvas->save();
+            rec.fClip(canvas);
+            draw_solid_scene(canvas);
+            canvas->restore();
+        };
+        GSurface direct(W, H);
+        direct.canvas()->clear({1, 0.1f, 0.2f, 0.3f});
+        const GPixel background = *direct.bitmap().getAddr(0, 0);
+        clipped_scene(direct.canvas());
+        stats->expectTrue(matches_through_mask(direct.bitmap(), expected, mask.bitmap(), background), rec.fMsg);
+
+        GBitmap tiledBitmap;
+        tiledBitmap.alloc(W, H);
+        {
+            auto tiled = GCreateTiledCanvas(tiledBitmap, 3);
+            tiled->clear({1, 0.1f, 0.2f, 0.3f});
+            clipped_scene(tiled.get());
+        }
+        stats->expectTrue(bitmap_eq(tiledBitmap, direct.bitmap()), "clip_tiled");
+        free(tiledBitmap.pixels());
+
+        auto recorder = GCreateRecordingCanvas();
+        clipped_scene(recorder.get());
+        auto picture = recorder->finishRecording();
+        GSurface played(W, H);
+        played.canvas()->clear({1, 0.1f, 0.2f, 0.3f});
+        picture->playback(played.canvas());
+        stats->expectTrue(bitmap_eq(played.bitmap(), direct.bitmap()), "clip_picture");
+
+        GWritePicture(*picture, path.c_str());
+        auto loaded = GReadPicture(path.c_str());
+        stats->expectPtr(loaded.get(), "clip_file_read");
+        if (loaded) {
+            played.canvas()->clear({1, 0.1f, 0.2f, 0.3f});
+            loaded->playback(played.canvas());
+            stats->expectTrue(bitmap_eq(played.bitmap(), direct.bitmap()), "clip_file");
+        }
+    }
+    remove(path.c_str());
+
+    // restore() brings back the unclipped canvas
+    GSurface surface(W, H);
+    surface.canvas()->save();
+    surface.canvas()->clipPath(star);
+    surface.canvas()->restore();
+    draw_solid_scene(surface.canvas());
+    stats->expectTrue(bitmap_eq(surface.bitmap(), reference.bitmap()), "clip_restore");
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+// Total coverage, counting each pixel's alpha as the fraction of it that is covered
+static double alpha_area(const GBitmap& bitmap) {
+    double area = 0;
+    for (int y = 0; y < bitmap.height(); ++y) {
+        for (int x = 0; x < bitmap.width(); ++x) {
+            area += GPixel_GetA(*bitmap.getAddr(x, y)) / 255.0;
+        }
+    }
+    return area;
+}
+
+static void draw_aa_scene(GCanvas* canvas, bool antiAlias) {
+    canvas->clear({1, 1, 1, 1});
+    GPaint paint({0.8f, 0.2f, 0.4f, 0.9f});
+    paint.setAntiAlias(antiAlias);
+    GPath path;
+    path.addCircle({50.3f, 45.7f}, 30.2f);
+    path.moveTo(10, 100).cubicTo(150, 5, 5, 5, 140, 115).lineTo(10, 100);
+    canvas->drawPath(path, paint);
+
+    canvas->save();
+    canvas->translate(75, 75);
+    canvas->rotate(0.5f);
+    GPaint src({1, 0, 1, 0});
+    src.setAntiAlias(antiAlias);
+    src.setBlendMode(GBlendMode::kSrc);
+    canvas->drawRect(GRect::MakeXYWH(-20.5f, -10.25f, 40, 20), src);
+    canvas->restore();
+
+    const GPoint tri[] = { {5.5f, 125}, {145.25f, 130.6f}, {75, 149} };
+    GPaint xorPaint({0.5f, 1, 0, 0});
+    xorPaint.setAntiAlias(antiAlias);
+    xorPaint.setBlendMode(GBlendMode::kXor);
+    canvas->drawConvexPolygon(tri, 3, xorPaint);
+}
+
+static void test_anti_alias(GTestStats* stats) {
+    GPaint black({1, 0, 0, 0});
+    black.setAntiAlias(true);
+
+    // edges through pixel centers cover half of their pixels, and corners a quarter
+    {
+        GSurface surface(30, 30);
+        surface.canvas()->clear({0, 0, 0, 0});
+        surface.canvas()->drawRect(GRect::MakeLTRB(10.5f, 10.5f, 20.5f, 20.5f), black);
+        const GBitmap& bm = surface.bitmap();
+        stats->expectTrue(abs(GPixel_GetA(*bm.getAddr(10, 15)) - 128) <= 1, "aa_rect_edge");
+        stats->expectTrue(abs(GPixel_GetA(*bm.getAddr(10, 10)) - 64) <= 1, "aa_rect_corner");
+        stats->expectTrue(GPixel_GetA(*bm.getAddr(15, 15)) == 0xFF && GPixel_GetA(*bm.getAddr(9, 15)) == 0,
+                          "aa_rect_inside_outside");
+        stats->expectTrue(fabs(alpha_area(bm) - 100) < 0.5, "aa_rect_area");
+    }
+
+    // a rect on pixel boundaries draws exactly as it does aliased
+    {
+        GSurface aliased(30, 30), smooth(30, 30);
+        aliased.canvas()->clear({1, 1, 1, 1});
+        smooth.canvas()->clear({1, 1, 1, 1});
+        GPaint paint({0.7f, 0.3f, 0.1f, 0.9f});
+        aliased.canvas()->drawRect(GRect::MakeLTRB(3, 4, 25, 27), paint);
+        paint.setAntiAlias(true);
+        smooth.canvas()->drawRect(GRect::MakeLTRB(3, 4, 25, 27), paint);
+        stats->expectTrue(bitmap_eq(aliased.bitmap(), smooth.bitmap()), "aa_rect_integral");
+    }
+
+    // circles and a triangle cover their true areas
+    bool areasOK = true;
+    for (float radius : { 0.7f, 3.3f, 17.5f, 45.0f }) {
+        for (float offset : { 0.0f, 0.37f }) {
+            GSurface surface(100, 100);
+            surface.canvas()->clear({0, 0, 0, 0});
+            GPath path;
+            path.addCircle({50 + offset, 50 + offset * 0.5f}, radius);
+            surface.canvas()->drawPath(path, black);
+            double exact = M_PI * radius * radius;
+            areasOK &= fabs(alpha_area(surface.bitmap()) - exact) < 0.01 * exact + 0.6;
+        }
+    }
+    stats->expectTrue(areasOK, "aa_circle_area");
+    {
+        GSurface surface(100, 100);
+        surface.canvas()->clear({0, 0, 0, 0});
+        const GPoint tri[] = { {10.3f, 20.6f}, {90.1f, 35.2f}, {40.7f, 85.9f} };
+        surface.canvas()->drawConvexPolygon(tri, 3, black);
+        double exact = fabs((tri[1].x() - tri[0].x()) * (tri[2].y() - tri[0].y()) -
+                            (tri[2].x() - tri[0].x()) * (tri[1].y() - tri[0].y())) / 2;
+        stats->expectTrue(fabs(alpha_area(surface.bitmap()) - exact) < 0.005 * exact, "aa_polygon_area");
+    }
+
+    // a kSrc edge lerps toward the src, so it stays opaque over an opaque dst
+    {
+        GSurface surface(20, 20);
+        surface.canvas()->clear({1, 1, 1, 1});
+        GPaint src({1, 1, 0, 0});
+        src.setAntiAlias(true);
+        src.setBlendMode(GBlendMode::kSrc);
+        surface.canvas()->drawRect(GRect::MakeLTRB(2.5f, 2.5f, 10.5f, 10.5f), src);
+        stats->expectEQ(GPixel_GetA(*surface.bitmap().getAddr(2, 5)), 0xFF, "aa_src_edge");
+    }
+
+    // the same pixels tiled, clipped, recorded and read back from a file
+    const int W = 150, H = 150;
+    GSurface direct(W, H), aliased(W, H);
+    draw_aa_scene(direct.canvas(), true);
+    draw_aa_scene(aliased.canvas(), false);
+    stats->expectFalse(bitmap_eq(direct.bitmap(), aliased.bitmap()), "aa_scene_differs");
+
+    GBitmap tiledBitmap;
+    tiledBitmap.alloc(W, H);
+    {
+        auto tiled = GCreateTiledCanvas(tiledBitmap, 3);
+        draw_aa_scene(tiled.get(), true);
+    }
+    stats->expectTrue(bitmap_eq(tiledBitmap, direct.bitmap()), "aa_tiled");
+    free(tiledBitmap.pixels());
+
+    GSurface clipped(W, H), mask(W, H);
+    const GRect clip = GRect::MakeLTRB(17, 21, 111, 130);
+    clipped.canvas()->clear({0, 0, 0, 0});
+    clipped.canvas()->clipRect(clip);
+    draw_aa_scene(clipped.canvas(), true);
+    mask.canvas()->clear({0, 0, 0, 0});
+    mask.canvas()->drawRect(clip, GPaint());
+    stats->expectTrue(matches_through_mask(clipped.bitmap(), direct.bitmap(), mask.bitmap(), 0), "aa_clip");
+
+    auto recorder = GCreateRecordingCanvas();
+    draw_aa_scene(recorder.get(), true);
+    auto picture = recorder->finishRecording();
+    GSurface played(W, H);
+    picture->playback(played.canvas());
+    stats->expectTrue(bitmap_eq(played.bitmap(), direct.bitmap()), "aa_picture");
+
+    const std::string path = temp_picture_path();
+    GWritePicture(*picture, path.c_str());
+    auto loaded = GReadPicture(path.c_str());
+    stats->expectPtr(loaded.get(), "aa_file_read");
+    if (loaded) {
+        GSurface fromFile(W, H);
+        loaded->playback(fromFile.canvas());
+        stats->expectTrue(bitmap_eq(fromFile.bitmap(), direct.bitmap()), "aa_file");
+    }
+    remove(path.c_str());
+}
+
 const GTestRec gTestRecs[] = {
     { test_clear,       "clear"         },
     { test_rect_colors, "rect_colors"   },
@@ -321,6 +1266,21 @@ const GTestRec gTestRecs[] = {
     { test_edger_quads, "test_edger_quads"  },
     { test_path_circle, "test_path_circle"  },
 
+    { test_blend_simd,  "blend_simd"        },
+
+    { test_bilerp_simd, "bilerp_simd"       },
+    { test_bitmap_filtering, "bitmap_filtering" },
+
+    { test_radial_sweep, "radial_sweep"     },
+
+    { test_tiled_canvas, "tiled_canvas"     },
+
+    { test_picture_playback, "picture_playback" },
+    { test_picture_file, "picture_file"     },
+
+    { test_clip,        "clip"              },
+    { test_anti_alias,  "anti_alias"        },
+
     { nullptr, nullptr },
 };
 
@@ -63,6 +63,17 @@ public:
      */
     virtual void concat(const GMatrix& matrix) = 0;
 
+    /**
+     *  Intersect the clip with the rect or path (mapped by the CTM). Later draws only touch the
+     *  pixels whose centers are inside the clip, following the same containment rules as
+     *  drawRect() and drawPath() (winding-fill). The clip starts as the whole canvas, and is saved
+     *  and restored along with the CTM.
+     *
+     *  A layer's restore() blends it onto the surface below through the clip of that surface.
+     */
+    virtual void clipRect(const GRect&) = 0;
+    virtual void clipPath(const GPath&) = 0;
+
     /**
      *  Fill the entire canvas with the specified color, using the specified blendmode.
      */
@@ -86,6 +97,12 @@ public:
      */
     virtual void drawPath(const GPath&, const GPaint&) = 0;
 
+    /**
+     *  Make sure every draw so far has landed in the bitmap. Canvases that draw immediately have
+     *  nothing to do; deferred ones (see GCreateTiledCanvas) rasterize everything pending.
+     */
+    virtual void flush() {}
+
     // Helpers
 
     void translate(float x, float y) {
@@ -120,4 +137,17 @@ protected:
  */
 std::unique_ptr<GCanvas> GCreateCanvas(const GBitmap& bitmap);
 
+/**
+ *  Return a canvas that records its draws, and on flush() (or when it is destroyed) rasterizes
+ *  them into horizontal bands of the bitmap in parallel, on threadCount threads (0 means one per
+ *  core). Each band only replays the draws whose device bounds touch it. The pixels are identical
+ *  to drawing the same calls with GCreateCanvas.
+ *
+ *  Shaders and filters are clone()d when first recorded after a flush, and each band draws with
+ *  its own clone. So a bitmap shader's pixels must not change between draws in one flush. Ones
+ *  that cannot be cloned are used one band at a time, and are flushed before the draw returns
+ *  (for a saveLayer's filter, before the matching restore returns).
+ */
+std::unique_ptr<GCanvas> GCreateTiledCanvas(const GBitmap& bitmap, int threadCount = 0);
+
 #endif
@@ -5,6 +5,9 @@
 #ifndef GFilter_DEFINED
 #define GFilter_DEFINED
 
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
 #include <memory>
 #include "GBlendMode.h"
 #include "GPixel.h"
@@ -28,6 +31,32 @@ public:
      *  Filter each input[i] pixel, and return the new value in output[i]
      */
     virtual void filter(GPixel output[], const GPixel input[], int count) = 0;
+
+    /**
+     *  Return a new filter that behaves exactly like this one, but shares no state with it (so
+     *  the two can be used on different threads), or null if that is not supported.
+     */
+    virtual std::unique_ptr<GFilter> clone() const { return nullptr; }
+
+    /**
+     *  Return roughly how much memory this filter holds, itself included. Pictures add this up
+     *  for the filters they keep.
+     */
+    virtual size_t approximateBytesUsed() const { return sizeof(GFilter); }
+
+    /**
+     *  Return an ID that no other filter in this process has, even one that later reuses this
+     *  filter's address. Canvases that keep clones use it to find the clone they already made.
+     */
+    uint32_t uniqueID() const { return fUniqueID; }
+
+private:
+    static uint32_t NextUniqueID() {
+        static std::atomic<uint32_t> gNextID{1};
+        return gNextID++;
+    }
+
+    const uint32_t fUniqueID = NextUniqueID();
 };
 
 /**
@@ -36,11 +36,19 @@ public:
     GFilter* getFilter() const { return fFilter; }
     GPaint&  setFilter(GFilter* filter) { fFilter = filter; return *this; }
 
+    /**
+     *  When set, the edges of rects, polygons and paths are drawn with partial coverage of the
+     *  pixels they cross, instead of each pixel being in or out by its center.
+     */
+    bool    isAntiAlias() const { return fAntiAlias; }
+    GPaint& setAntiAlias(bool aa) { fAntiAlias = aa; return *this; }
+
 private:
     GColor      fColor = GColor::MakeARGB(1, 0, 0, 0);
     GShader*    fShader = nullptr;
     GFilter*    fFilter = nullptr;
     GBlendMode  fMode = GBlendMode::kSrcOver;
+    bool        fAntiAlias = false;
 };
 
 #endif
@@ -0,0 +1,63 @@
+#ifndef GPicture_DEFINED
+#define GPicture_DEFINED
+
+#include "GCanvas.h"
+#include <memory>
+
+/**
+ *  An immutable recording of canvas calls, made with a GRecordingCanvas, that can be replayed
+ *  into any canvas, any number of times.
+ *
+ *  The picture owns copies of its paths, and clone()s of its shaders and filters. Shaders and
+ *  filters that cannot be cloned are only referenced, and must outlive the picture. Since the
+ *  clones are shared by every playback, a picture should only be played back on one thread at a
+ *  time.
+ */
+class GPicture {
+public:
+    virtual ~GPicture() {}
+
+    /**
+     *  Replay the recorded calls into the canvas, on top of its current CTM. The canvas's CTM and
+     *  save/restore depth are the same afterwards.
+     */
+    virtual void playback(GCanvas*) const = 0;
+
+    /**
+     *  The number of recorded calls, and the bytes used to hold them.
+     */
+    virtual int countCommands() const = 0;
+    virtual size_t approximateBytesUsed() const = 0;
+};
+
+class GRecordingCanvas : public GCanvas {
+public:
+    /**
+     *  Return everything drawn since the canvas was created (or since the last call) as a picture,
+     *  balancing any saves that are still open, and start over with an empty recording and an
+     *  identity CTM.
+     */
+    virtual std::unique_ptr<GPicture> finishRecording() = 0;
+};
+
+/**
+ *  Return a canvas that draws nothing, but records its calls for finishRecording().
+ */
+std::unique_ptr<GRecordingCanvas> GCreateRecordingCanvas();
+
+/**
+ *  Write the picture's calls to a file in the binary picture format (described in
+ *  PictureFile.cpp), for GReadPicture() to load. Shaders and filters cannot be written, so this
+ *  writes nothing and returns false if any paint has one. Also returns false if the file cannot
+ *  be written.
+ */
+bool GWritePicture(const GPicture&, const char path[]);
+
+/**
+ *  Map a file made by GWritePicture() and return a picture that plays back straight from the
+ *  mapping, without building any commands or allocating per command. Returns null if the file
+ *  cannot be mapped, or is not a well-formed picture of a version we know.
+ */
+std::unique_ptr<GPicture> GReadPicture(const char path[]);
+
+#endif
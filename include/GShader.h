@@ -5,6 +5,9 @@
 #ifndef GShader_DEFINED
 #define GShader_DEFINED
 
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
 #include <memory>
 #include "GColor.h"
 #include "GPixel.h"
@@ -24,6 +27,14 @@ public:
         kMirror,
     };
 
+    // How the bitmap shader samples its bitmap: the nearest texel, a blend of the four nearest
+    // texels, or that blend taken in (and between) the two mip levels nearest the draw's scale.
+    enum FilterQuality {
+        kNearest,
+        kBilinear,
+        kTrilinear,
+    };
+
     virtual ~GShader() {}
 
     // Return true iff all of the GPixels that may be returned by this shader will be opaque.
@@ -38,14 +49,44 @@ public:
      *  can hold at least [count] entries.
      */
     virtual void shadeRow(int x, int y, int count, GPixel row[]) = 0;
+
+    /**
+     *  Return a new shader that draws exactly the same pixels as this one, but shares no state
+     *  with it (so the two can be used on different threads), or null if that is not supported.
+     */
+    virtual std::unique_ptr<GShader> clone() const { return nullptr; }
+
+    /**
+     *  Return roughly how much memory this shader holds, itself included (e.g. a copy of its
+     *  bitmap's pixels). Pictures add this up for the shaders they keep.
+     */
+    virtual size_t approximateBytesUsed() const { return sizeof(GShader); }
+
+    /**
+     *  Return an ID that no other shader in this process has, even one that later reuses this
+     *  shader's address. Canvases that keep clones use it to find the clone they already made.
+     */
+    uint32_t uniqueID() const { return fUniqueID; }
+
+private:
+    static uint32_t NextUniqueID() {
+        static std::atomic<uint32_t> gNextID{1};
+        return gNextID++;
+    }
+
+    const uint32_t fUniqueID = NextUniqueID();
 };
 
 /**
  *  Return a subclass of GShader that draws the specified bitmap and the inverse of a local matrix.
  *  Returns null if the either parameter is invalid.
+ *
+ *  With kTrilinear, the shader builds (once, on the first draw that shrinks the bitmap) and keeps
+ *  a mip pyramid of the bitmap, so the bitmap's pixels must not change while the shader is alive.
  */
 std::unique_ptr<GShader> GCreateBitmapShader(const GBitmap&, const GMatrix& localInv,
-                                             GShader::TileMode = GShader::kClamp);
+                                             GShader::TileMode = GShader::kClamp,
+                                             GShader::FilterQuality = GShader::kNearest);
 
 /**
  *  Return a subclass of GShader that draws the specified gradient of [count] colors between
@@ -68,4 +109,27 @@ static inline std::unique_ptr<GShader> GCreateLinearGradient(GPoint p0, GPoint p
     return GCreateLinearGradient(p0, p1, colors, 2, mode);
 }
 
+/**
+ *  Return a subclass of GShader that draws the specified gradient of [count] colors in circles
+ *  around center. Color[0] is at the center, and Color[count-1] is at the radius; the tile mode
+ *  decides what happens past the radius.
+ *
+ *  If count < 1, or radius is not positive, this returns nullptr.
+ */
+std::unique_ptr<GShader> GCreateRadialGradient(GPoint center, float radius, const GColor[],
+                                               int count, GShader::TileMode = GShader::kClamp);
+
+/**
+ *  Return a subclass of GShader that draws the specified gradient of [count] colors sweeping
+ *  around center. Color[0] is at startRadians, and Color[count-1] is at endRadians, measured the
+ *  same way as GMatrix::setRotate (so increasing angles turn towards positive Y). Angles are
+ *  taken from startRadians up to one full turn, and the tile mode covers the part of the turn
+ *  past endRadians.
+ *
+ *  If count < 1, or endRadians <= startRadians, this returns nullptr.
+ */
+std::unique_ptr<GShader> GCreateSweepGradient(GPoint center, float startRadians, float endRadians,
+                                              const GColor[], int count,
+                                              GShader::TileMode = GShader::kClamp);
+
 #endif
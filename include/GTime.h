@@ -10,10 +10,17 @@
 #include "GTypes.h"
 
 typedef unsigned long GMSec;
+typedef uint64_t GNSec;
 
 class GTime {
 public:
     static GMSec GetMSec();
+
+    /**
+     *  Nanoseconds from a monotonic clock with an unspecified start, so only differences between
+     *  two calls mean anything. Unlike GetMSec(), it never jumps when the wall clock is set.
+     */
+    static GNSec GetNSec();
 };
 
 #endif